@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <tesparse/TESFileFormatDescription.h>
+
+/*
+ * Loads a description from XML and from its binary form, as stored in cache
+ * files, and reports the time per load. Both include compiling the
+ * definitions into decoding programs and subrecord state machines.
+ *
+ * Usage: DescriptionLoadBenchmark [description file] [rounds]
+ */
+
+namespace {
+	double millisecondsPerLoad(const std::vector<unsigned char> &data, unsigned int rounds) {
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned int round = 0; round < rounds; round++) {
+			tesparse::TESFileFormatDescription desc;
+			desc.loadFromMemory(data.data(), static_cast<unsigned int>(data.size()));
+		}
+
+		auto elapsed = std::chrono::steady_clock::now() - start;
+
+		return std::chrono::duration<double, std::milli>(elapsed).count() / rounds;
+	}
+}
+
+int main(int argc, char **argv) {
+	std::string filename = argc > 1 ? argv[1] : TESPARSE_DESCRIPTION_DIR "/morrowind.xml";
+	unsigned int rounds = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], nullptr, 10)) : 200;
+
+	std::ifstream stream(filename, std::ios::binary);
+	if (!stream) {
+		fprintf(stderr, "cannot open %s\n", filename.c_str());
+		return 1;
+	}
+
+	std::vector<unsigned char> xml{ std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+	if (rounds == 0) {
+		fprintf(stderr, "nothing to benchmark\n");
+		return 1;
+	}
+
+	tesparse::TESFileFormatDescription desc;
+	desc.loadFromMemory(xml.data(), static_cast<unsigned int>(xml.size()));
+	auto binary = desc.serialize();
+
+	auto xmlTime = millisecondsPerLoad(xml, rounds);
+	auto binaryTime = millisecondsPerLoad(binary, rounds);
+
+	printf("%s: %zu bytes of XML, %zu bytes binary, %u rounds\n", filename.c_str(), xml.size(), binary.size(), rounds);
+	printf("XML:    %8.3f ms/load\n", xmlTime);
+	printf("binary: %8.3f ms/load (%.1fx)\n", binaryTime, xmlTime / binaryTime);
+
+	return 0;
+}
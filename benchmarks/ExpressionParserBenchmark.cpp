@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <tesparse/ExpressionParser.h>
+
+#include "RegexExpressionParser.h"
+
+/*
+ * Tokenizes every Length expression of a description with ExpressionParser
+ * and with the regex-based baseline, checks that both produce the same
+ * tokens, and reports the time per expression.
+ *
+ * Usage: ExpressionParserBenchmark [description file] [rounds]
+ */
+
+namespace {
+	std::vector<std::string> lengthExpressions(const std::string &filename) {
+		std::ifstream stream(filename, std::ios::binary);
+		if (!stream) {
+			fprintf(stderr, "cannot open %s\n", filename.c_str());
+			exit(1);
+		}
+
+		std::string text{ std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+
+		std::vector<std::string> expressions;
+		std::regex lengthAttribute("Length=\"([^\"]*)\"");
+		for (auto it = std::sregex_iterator(text.begin(), text.end(), lengthAttribute); it != std::sregex_iterator(); ++it) {
+			expressions.push_back((*it)[1].str());
+		}
+
+		return expressions;
+	}
+
+	template<typename Parser>
+	double nanosecondsPerExpression(const std::vector<std::string> &expressions, unsigned int rounds) {
+		size_t tokens = 0;
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned int round = 0; round < rounds; round++) {
+			for (const auto &expression : expressions) {
+				Parser parser;
+				parser.parse(expression);
+				tokens += parser.expression().size();
+			}
+		}
+
+		auto elapsed = std::chrono::steady_clock::now() - start;
+
+		// Keeps the parsing from being optimized out
+		if (tokens == 0)
+			printf("no tokens\n");
+
+		return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(rounds) * expressions.size());
+	}
+}
+
+int main(int argc, char **argv) {
+	std::string filename = argc > 1 ? argv[1] : TESPARSE_DESCRIPTION_DIR "/morrowind.xml";
+	unsigned int rounds = argc > 2 ? static_cast<unsigned int>(strtoul(argv[2], nullptr, 10)) : 20000;
+
+	auto expressions = lengthExpressions(filename);
+	if (expressions.empty() || rounds == 0) {
+		fprintf(stderr, "nothing to benchmark\n");
+		return 1;
+	}
+
+	for (const auto &expression : expressions) {
+		tesparse::ExpressionParser scanner;
+		scanner.parse(expression);
+
+		tesparse::RegexExpressionParser baseline;
+		baseline.parse(expression);
+
+		if (scanner.expression() != baseline.expression()) {
+			fprintf(stderr, "tokens differ from the baseline: %s\n", expression.c_str());
+			return 1;
+		}
+	}
+
+	auto baseline = nanosecondsPerExpression<tesparse::RegexExpressionParser>(expressions, rounds);
+	auto scanner = nanosecondsPerExpression<tesparse::ExpressionParser>(expressions, rounds);
+
+	printf("%zu Length expressions from %s, %u rounds\n", expressions.size(), filename.c_str(), rounds);
+	printf("regex baseline: %10.1f ns/expression\n", baseline);
+	printf("scanner:        %10.1f ns/expression (%.1fx)\n", scanner, baseline / scanner);
+
+	return 0;
+}
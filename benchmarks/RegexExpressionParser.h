@@ -0,0 +1,31 @@
+#ifndef TESPARSE_BENCHMARKS_REGEX_EXPRESSION_PARSER_H
+#define TESPARSE_BENCHMARKS_REGEX_EXPRESSION_PARSER_H
+
+#include <tesparse/Expression.h>
+
+namespace tesparse {
+	/*
+	 * ExpressionParser as it was before the tokenizer was rewritten as a
+	 * scanner, kept unchanged as the baseline for the tokenizer benchmark.
+	 */
+	class RegexExpressionParser {
+	public:
+		RegexExpressionParser();
+		~RegexExpressionParser();
+
+		RegexExpressionParser(const RegexExpressionParser &other) = delete;
+		RegexExpressionParser &operator =(const RegexExpressionParser &other) = delete;
+
+		void parse(const std::string_view &string);
+
+		inline Expression &&expression() { return std::move(m_expression); }
+
+	private:
+		static unsigned int operatorPrecedence(ExpressionOperator op);
+
+		Expression m_expression;
+		std::vector<ExpressionOperator> m_operatorStack;
+	};
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include "BinaryEncoding.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || (defined(__i386__) && defined(__SSE2__))
+#define TESPARSE_CLI_X86_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(TESPARSE_CLI_X86_SIMD) && !defined(_MSC_VER)
+#define TESPARSE_CLI_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TESPARSE_CLI_TARGET_AVX2
+#endif
+
+static const char hexDigits[]{ '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+
+static void encodeHexScalar(const unsigned char *data, size_t size, char *output) {
+	for (size_t pos = 0; pos < size; pos++) {
+		auto byte = data[pos];
+
+		output[pos * 2] = hexDigits[byte >> 4];
+		output[pos * 2 + 1] = hexDigits[byte & 15];
+	}
+}
+
+#ifdef TESPARSE_CLI_X86_SIMD
+
+/*
+ * Nibble to digit: '0' + n, plus 7 more for n > 9 to skip to 'A'.
+ */
+static inline __m128i nibblesToHexSSE2(__m128i nibbles) {
+	auto letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8(7));
+	return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+static void encodeHexSSE2(const unsigned char *data, size_t size, char *output) {
+	auto mask = _mm_set1_epi8(15);
+
+	size_t pos = 0;
+	for (; pos + 16 <= size; pos += 16) {
+		auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+
+		auto high = nibblesToHexSSE2(_mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+		auto low = nibblesToHexSSE2(_mm_and_si128(bytes, mask));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(output + pos * 2), _mm_unpacklo_epi8(high, low));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(output + pos * 2 + 16), _mm_unpackhi_epi8(high, low));
+	}
+
+	encodeHexScalar(data + pos, size - pos, output + pos * 2);
+}
+
+TESPARSE_CLI_TARGET_AVX2 static inline __m256i nibblesToHexAVX2(__m256i nibbles) {
+	auto letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8(7));
+	return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+}
+
+/*
+ * The AVX2 unpacks interleave within each 128-bit lane, so the lanes are
+ * reordered afterwards to put the output back in sequence.
+ */
+TESPARSE_CLI_TARGET_AVX2 static void encodeHexAVX2(const unsigned char *data, size_t size, char *output) {
+	auto mask = _mm256_set1_epi8(15);
+
+	size_t pos = 0;
+	for (; pos + 32 <= size; pos += 32) {
+		auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+
+		auto high = nibblesToHexAVX2(_mm256_and_si256(_mm256_srli_epi16(bytes, 4), mask));
+		auto low = nibblesToHexAVX2(_mm256_and_si256(bytes, mask));
+
+		auto interleavedLow = _mm256_unpacklo_epi8(high, low);
+		auto interleavedHigh = _mm256_unpackhi_epi8(high, low);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(output + pos * 2), _mm256_permute2x128_si256(interleavedLow, interleavedHigh, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(output + pos * 2 + 32), _mm256_permute2x128_si256(interleavedLow, interleavedHigh, 0x31));
+	}
+
+	encodeHexSSE2(data + pos, size - pos, output + pos * 2);
+}
+
+static bool processorSupportsAVX2() {
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// OSXSAVE and AVX, and the OS saving the YMM state
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+void encodeHex(const unsigned char *data, size_t size, char *output) {
+#ifdef TESPARSE_CLI_X86_SIMD
+	static const auto implementation = processorSupportsAVX2() ? encodeHexAVX2 : encodeHexSSE2;
+#else
+	static const auto implementation = encodeHexScalar;
+#endif
+
+	implementation(data, size, output);
+}
+
+void encodeBase64(const unsigned char *data, size_t size, char *output) {
+	static const char alphabet[]{
+		'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+		'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+		'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+		'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'
+	};
+
+	size_t pos = 0;
+	for (; pos + 3 <= size; pos += 3) {
+		unsigned int group = (data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2];
+
+		*output++ = alphabet[(group >> 18) & 63];
+		*output++ = alphabet[(group >> 12) & 63];
+		*output++ = alphabet[(group >> 6) & 63];
+		*output++ = alphabet[group & 63];
+	}
+
+	auto remaining = size - pos;
+	if (remaining != 0) {
+		unsigned int group = data[pos] << 16;
+		if (remaining == 2)
+			group |= data[pos + 1] << 8;
+
+		*output++ = alphabet[(group >> 18) & 63];
+		*output++ = alphabet[(group >> 12) & 63];
+		*output++ = remaining == 2 ? alphabet[(group >> 6) & 63] : '=';
+		*output++ = '=';
+	}
+}
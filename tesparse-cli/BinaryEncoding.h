@@ -0,0 +1,29 @@
+#ifndef TESPARSE_CLI_BINARY_ENCODING_H
+#define TESPARSE_CLI_BINARY_ENCODING_H
+
+#include <stddef.h>
+
+/*
+ * Encoders for ByteArray values. The output buffer must have room for
+ * exactly hexEncodedSize() or base64EncodedSize() characters; no terminator
+ * is written.
+ */
+
+inline size_t hexEncodedSize(size_t size) {
+	return size * 2;
+}
+
+inline size_t base64EncodedSize(size_t size) {
+	return (size + 2) / 3 * 4;
+}
+
+/*
+ * Upper-case hex. Uses AVX2 or SSE2 when the processor supports them,
+ * selected once at run time.
+ */
+void encodeHex(const unsigned char *data, size_t size, char *output);
+
+// Standard base64 alphabet with padding
+void encodeBase64(const unsigned char *data, size_t size, char *output);
+
+#endif
@@ -0,0 +1,285 @@
+#include "JsonWriter.h"
+
+#include <nlohmann/json.hpp>
+
+#include <charconv>
+#include <cmath>
+
+static const size_t flushThreshold = 1024 * 1024;
+static const size_t indentStep = 2;
+
+JsonWriter::JsonWriter(std::ostream &stream, bool pretty) : m_stream(&stream), m_pretty(pretty), m_afterKey(false) {
+	m_buffer.reserve(flushThreshold + flushThreshold / 4);
+}
+
+JsonWriter::JsonWriter(bool pretty) : m_stream(nullptr), m_pretty(pretty), m_afterKey(false) {
+
+}
+
+JsonWriter::~JsonWriter() = default;
+
+void JsonWriter::beginObject() {
+	beginContainer('{');
+}
+
+void JsonWriter::endObject() {
+	endContainer('}');
+}
+
+void JsonWriter::beginArray() {
+	beginContainer('[');
+}
+
+void JsonWriter::endArray() {
+	endContainer(']');
+}
+
+void JsonWriter::key(const std::string_view &name) {
+	beginValue();
+
+	write('\"');
+	writeEscaped(name);
+
+	if (m_pretty)
+		write("\": ", 3);
+	else
+		write("\":", 2);
+
+	m_afterKey = true;
+}
+
+void JsonWriter::null() {
+	beginValue();
+	write("null", 4);
+}
+
+void JsonWriter::value(uint32_t val) {
+	beginValue();
+
+	char buffer[16];
+	auto result = std::to_chars(buffer, buffer + sizeof(buffer), val);
+	write(buffer, static_cast<size_t>(result.ptr - buffer));
+}
+
+void JsonWriter::value(int32_t val) {
+	beginValue();
+
+	char buffer[16];
+	auto result = std::to_chars(buffer, buffer + sizeof(buffer), val);
+	write(buffer, static_cast<size_t>(result.ptr - buffer));
+}
+
+/*
+ * nlohmann::json stores floating point numbers as double, so the float is
+ * widened first to produce the same digits.
+ */
+void JsonWriter::value(float val) {
+	beginValue();
+
+	double widened = val;
+	if (!std::isfinite(widened)) {
+		write("null", 4);
+		return;
+	}
+
+	char buffer[64];
+	auto end = nlohmann::detail::to_chars(buffer, buffer + sizeof(buffer), widened);
+	write(buffer, static_cast<size_t>(end - buffer));
+}
+
+void JsonWriter::value(const std::string_view &val) {
+	beginValue();
+
+	write('\"');
+	writeEscaped(val);
+	write('\"');
+}
+
+char *JsonWriter::rawString(size_t length) {
+	beginValue();
+
+	auto offset = m_buffer.size();
+	m_buffer.resize(offset + length + 2);
+	m_buffer[offset] = '\"';
+	m_buffer[offset + length + 1] = '\"';
+
+	return &m_buffer[offset + 1];
+}
+
+void JsonWriter::endLine() {
+	write('\n');
+	maybeFlush();
+}
+
+void JsonWriter::flush() {
+	if (m_stream) {
+		m_stream->write(m_buffer.data(), m_buffer.size());
+		m_buffer.clear();
+	}
+}
+
+void JsonWriter::beginFragment(size_t depth, bool continuing) {
+	m_buffer.clear();
+	m_afterKey = false;
+	m_containers.assign(depth, Container{ false });
+
+	if (depth != 0)
+		m_containers.back().empty = !continuing;
+}
+
+std::string JsonWriter::takeBuffer() {
+	std::string buffer;
+	buffer.swap(m_buffer);
+	return buffer;
+}
+
+void JsonWriter::writeFragment(const std::string &fragment) {
+	if (fragment.empty())
+		return;
+
+	if (!m_containers.empty())
+		m_containers.back().empty = false;
+
+	write(fragment.data(), fragment.size());
+	maybeFlush();
+}
+
+void JsonWriter::beginValue() {
+	if (m_afterKey) {
+		m_afterKey = false;
+		return;
+	}
+
+	if (m_containers.empty())
+		return;
+
+	auto &container = m_containers.back();
+	if (!container.empty)
+		write(',');
+
+	if (m_pretty) {
+		write('\n');
+		writeIndent(m_containers.size());
+	}
+
+	container.empty = false;
+}
+
+void JsonWriter::beginContainer(char opening) {
+	beginValue();
+	write(opening);
+	m_containers.push_back(Container{ true });
+}
+
+void JsonWriter::endContainer(char closing) {
+	auto empty = m_containers.back().empty;
+	m_containers.pop_back();
+
+	if (m_pretty && !empty) {
+		write('\n');
+		writeIndent(m_containers.size());
+	}
+
+	write(closing);
+
+	maybeFlush();
+}
+
+void JsonWriter::writeIndent(size_t depth) {
+	m_buffer.append(depth * indentStep, ' ');
+}
+
+/*
+ * Follows nlohmann::json's escaping: the short escapes for ", \ and the
+ * common control characters, \u00XX for the other characters below 0x20,
+ * and everything else verbatim. Each ill-formed UTF-8 sequence is replaced
+ * by one U+FFFD, and a byte that breaks a sequence starts the next one.
+ */
+void JsonWriter::writeEscaped(const std::string_view &val) {
+	static const char hexDigits[]{ '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+	static const char replacementCharacter[]{ '\xEF', '\xBF', '\xBD' };
+
+	auto data = reinterpret_cast<const unsigned char *>(val.data());
+	auto size = val.size();
+
+	size_t position = 0;
+	while (position < size) {
+		auto byte = data[position];
+
+		if (byte < 0x80) {
+			switch (byte) {
+			case '\b': write("\\b", 2); break;
+			case '\t': write("\\t", 2); break;
+			case '\n': write("\\n", 2); break;
+			case '\f': write("\\f", 2); break;
+			case '\r': write("\\r", 2); break;
+			case '\"': write("\\\"", 2); break;
+			case '\\': write("\\\\", 2); break;
+			default:
+				if (byte < 0x20) {
+					char escape[]{ '\\', 'u', '0', '0', hexDigits[byte >> 4], hexDigits[byte & 15] };
+					write(escape, sizeof(escape));
+				}
+				else {
+					write(static_cast<char>(byte));
+				}
+				break;
+			}
+
+			position++;
+			continue;
+		}
+
+		size_t length;
+		unsigned char secondMin = 0x80, secondMax = 0xBF;
+
+		if (byte >= 0xC2 && byte <= 0xDF) {
+			length = 2;
+		}
+		else if (byte >= 0xE0 && byte <= 0xEF) {
+			length = 3;
+			if (byte == 0xE0)
+				secondMin = 0xA0;
+			else if (byte == 0xED)
+				secondMax = 0x9F;
+		}
+		else if (byte >= 0xF0 && byte <= 0xF4) {
+			length = 4;
+			if (byte == 0xF0)
+				secondMin = 0x90;
+			else if (byte == 0xF4)
+				secondMax = 0x8F;
+		}
+		else {
+			write(replacementCharacter, sizeof(replacementCharacter));
+			position++;
+			continue;
+		}
+
+		size_t accepted = 1;
+		while (accepted < length && position + accepted < size) {
+			auto continuation = data[position + accepted];
+			auto min = accepted == 1 ? secondMin : static_cast<unsigned char>(0x80);
+			auto max = accepted == 1 ? secondMax : static_cast<unsigned char>(0xBF);
+
+			if (continuation < min || continuation > max)
+				break;
+
+			accepted++;
+		}
+
+		if (accepted == length) {
+			write(reinterpret_cast<const char *>(data + position), length);
+		}
+		else {
+			write(replacementCharacter, sizeof(replacementCharacter));
+		}
+
+		position += accepted;
+	}
+}
+
+void JsonWriter::maybeFlush() {
+	if (m_stream && m_buffer.size() >= flushThreshold)
+		flush();
+}
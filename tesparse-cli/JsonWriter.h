@@ -0,0 +1,107 @@
+#ifndef TESPARSE_CLI_JSON_WRITER_H
+#define TESPARSE_CLI_JSON_WRITER_H
+
+#include <stdint.h>
+
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Streaming JSON writer. Values are appended to an internal buffer, which is
+ * flushed to the output stream whenever it grows past a threshold, so no
+ * document tree or complete output string is ever built.
+ *
+ * Output is byte-for-byte what nlohmann::json::dump produces for the same
+ * document with indent 2 (pretty) or -1 (compact), ensure_ascii off and
+ * invalid UTF-8 replaced with U+FFFD. Object keys are written in the order
+ * they are given; it is up to the caller to sort them if needed.
+ *
+ * A writer without an output stream only accumulates text in memory. Such a
+ * writer can produce a fragment of a larger document, which is then spliced
+ * into the document's writer with writeFragment(); this is how parts of the
+ * document are serialized in parallel.
+ */
+class JsonWriter {
+public:
+	explicit JsonWriter(std::ostream &stream, bool pretty);
+	explicit JsonWriter(bool pretty);
+	~JsonWriter();
+
+	JsonWriter(const JsonWriter &other) = delete;
+	JsonWriter &operator =(const JsonWriter &other) = delete;
+
+	void beginObject();
+	void endObject();
+
+	void beginArray();
+	void endArray();
+
+	void key(const std::string_view &name);
+
+	void null();
+	void value(uint32_t val);
+	void value(int32_t val);
+	void value(float val);
+	void value(const std::string_view &val);
+
+	/*
+	 * Writes a string value of the specified length and returns a pointer to
+	 * its characters, which the caller must fill. The characters are not
+	 * escaped.
+	 */
+	char *rawString(size_t length);
+
+	/*
+	 * Ends a top-level value with a line break, for writing one document per
+	 * line.
+	 */
+	void endLine();
+
+	void flush();
+
+	/*
+	 * Discards the buffer and starts a fragment consisting of values of a
+	 * container at the specified nesting depth. If 'continuing' is set, the
+	 * container already has values before the fragment.
+	 */
+	void beginFragment(size_t depth, bool continuing);
+
+	// Returns the buffered text, leaving the buffer empty
+	std::string takeBuffer();
+
+	/*
+	 * Appends a fragment produced by another writer, which was started with
+	 * beginFragment() at the current depth.
+	 */
+	void writeFragment(const std::string &fragment);
+
+private:
+	struct Container {
+		bool empty;
+	};
+
+	void beginValue();
+	void beginContainer(char opening);
+	void endContainer(char closing);
+	void writeIndent(size_t depth);
+	void writeEscaped(const std::string_view &val);
+	void maybeFlush();
+
+	inline void write(char ch) {
+		m_buffer.push_back(ch);
+	}
+
+	inline void write(const char *data, size_t size) {
+		m_buffer.append(data, size);
+	}
+
+	std::ostream *m_stream;
+	bool m_pretty;
+	bool m_afterKey;
+	std::string m_buffer;
+	std::vector<Container> m_containers;
+};
+
+#endif
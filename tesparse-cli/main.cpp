@@ -1,101 +1,389 @@
 #include <tesparse/TESFileFormatDescription.h>
 #include <tesparse/TESGameData.h>
+#include <tesparse/StringConversions.h>
+#include <tesparse/FourCC.h>
 
 #include "CLI11.hpp"
-#include <nlohmann/json.hpp>
+#include "JsonWriter.h"
+#include "BinaryEncoding.h"
 
-nlohmann::json convertValue(const tesparse::TESStruct &st);
-nlohmann::json convertValue(const tesparse::TESArray &st);
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
-nlohmann::json convertValue(tesparse::TESUInt v) {
-	return v;
-}
+enum class BinaryEncoding {
+	Hex,
+	Base64
+};
 
-nlohmann::json convertValue(tesparse::TESInt v) {
-	return v;
-}
+/*
+ * Writes parsed values through JsonWriter. Struct fields are written in
+ * name order, which is the order the output has always had.
+ */
+class ValueSerializer {
+public:
+	ValueSerializer(JsonWriter &writer, BinaryEncoding binaryEncoding, tesparse::StringEncoding stringEncoding) :
+		m_writer(writer), m_binaryEncoding(binaryEncoding), m_stringEncoding(stringEncoding) {
 
-nlohmann::json convertValue(float v) {
-	return v;
-}
+	}
 
-nlohmann::json convertValue(const std::vector<unsigned char> &v) {
-	static const char characterTable[] { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+	void writeRecord(const std::string &type, const tesparse::TESStruct *data) {
+		m_writer.beginObject();
+		m_writer.key("data");
+		writeValue(data);
+		m_writer.key("type");
+		m_writer.value(type);
+		m_writer.endObject();
+	}
 
-	std::string output;
-	output.resize(v.size() * 2);
-	for (size_t pos = 0, size = v.size(); pos < size; pos++) {
-		auto byte = v[pos];
+	void writeValue(const tesparse::TESStruct *st) {
+		if (st) {
+			writeValue(*st);
+		}
+		else {
+			m_writer.null();
+		}
+	}
 
-		output[pos * 2] = characterTable[byte >> 4];
-		output[pos * 2 + 1] = characterTable[byte & 15];
+	void writeValue(const tesparse::TESValue &val) {
+		std::visit([this](const auto &val) {
+			writeValue(val);
+		}, val);
 	}
 
-	return output;
-}
+	void writeValue(const tesparse::TESStruct &st) {
+		m_writer.beginObject();
 
-nlohmann::json convertValue(const std::string &v) {
-	return v;
-}
+		for (auto slot : sortedSlots(st.layout)) {
+			if (st.hasField(slot)) {
+				m_writer.key(st.fieldName(slot));
+				writeValue(st.fields[slot]);
+			}
+		}
 
-nlohmann::json convertValue(const tesparse::TESValue &val) {
-	return std::visit([](const auto &val) {
-		return convertValue(val);
-	}, val);
-}
+		m_writer.endObject();
+	}
 
-nlohmann::json convertValue(const tesparse::TESStruct &st) {
-	auto obj = nlohmann::json::object();
+	void writeValue(const tesparse::TESArray &arr) {
+		m_writer.beginArray();
 
-	for (const auto &pair : st.fields) {
-		obj[pair.first] = convertValue(pair.second);
+		for (const auto &val : arr.values) {
+			writeValue(val);
+		}
+
+		m_writer.endArray();
 	}
 
-	return obj;
-}
+	template<typename T>
+	void writeValue(const tesparse::TESTypedArray<T> &arr) {
+		m_writer.beginArray();
 
-nlohmann::json convertValue(const tesparse::TESArray &st) {
-	auto obj = nlohmann::json::array();
+		for (auto val : arr.values) {
+			m_writer.value(val);
+		}
 
-	for (const auto &val : st.values) {
-		obj.push_back(convertValue(val));
+		m_writer.endArray();
 	}
 
-	return obj;
-}
+	void writeValue(std::monostate) {
+		m_writer.null();
+	}
 
-nlohmann::json convertValue(const std::unique_ptr<tesparse::TESStruct> &ptrToStruct) {
-	return convertValue(*ptrToStruct);
-}
+	void writeValue(tesparse::TESUInt v) {
+		m_writer.value(v);
+	}
+
+	void writeValue(tesparse::TESInt v) {
+		m_writer.value(v);
+	}
+
+	void writeValue(float v) {
+		m_writer.value(v);
+	}
+
+	void writeValue(const std::pmr::vector<unsigned char> &v) {
+		writeBytes(v.data(), v.size());
+	}
+
+	void writeValue(const tesparse::TESByteArrayView &v) {
+		writeBytes(v.data, v.size);
+	}
+
+	void writeValue(const std::pmr::string &v) {
+		writeString(v);
+	}
+
+	void writeValue(const std::string_view &v) {
+		writeString(v);
+	}
+
+private:
+	void writeString(const std::string_view &v) {
+		if (m_stringEncoding == tesparse::StringEncoding::Windows1252 && tesparse::asciiPrefixLength(v.data(), v.size()) != v.size()) {
+			tesparse::windows1252ToUtf8(v, m_transcodedString);
+			m_writer.value(m_transcodedString);
+		}
+		else {
+			m_writer.value(v);
+		}
+	}
+
+	void writeBytes(const unsigned char *data, size_t size) {
+		if (m_binaryEncoding == BinaryEncoding::Base64) {
+			encodeBase64(data, size, m_writer.rawString(base64EncodedSize(size)));
+		}
+		else {
+			encodeHex(data, size, m_writer.rawString(hexEncodedSize(size)));
+		}
+	}
+
+	const std::vector<tesparse::TESFieldSlot> &sortedSlots(const tesparse::TESStructLayout *layout) {
+		auto it = m_sortedSlots.find(layout);
+		if (it == m_sortedSlots.end()) {
+			std::vector<tesparse::TESFieldSlot> slots(layout ? layout->size() : 0);
+			for (tesparse::TESFieldSlot slot = 0; slot < slots.size(); slot++) {
+				slots[slot] = slot;
+			}
+
+			std::sort(slots.begin(), slots.end(), [layout](tesparse::TESFieldSlot a, tesparse::TESFieldSlot b) {
+				return layout->fieldName(a) < layout->fieldName(b);
+			});
+
+			it = m_sortedSlots.emplace(layout, std::move(slots)).first;
+		}
+
+		return it->second;
+	}
+
+	JsonWriter &m_writer;
+	BinaryEncoding m_binaryEncoding;
+	tesparse::StringEncoding m_stringEncoding;
+	std::string m_transcodedString;
+	std::unordered_map<const tesparse::TESStructLayout *, std::vector<tesparse::TESFieldSlot>> m_sortedSlots;
+};
+
+/*
+ * Writes all records, either as values of the writer's current container at
+ * the specified depth, or one per line if 'lines' is set.
+ *
+ * With more than one thread, records are serialized in chunks into separate
+ * in-memory fragments by worker threads, while the calling thread appends
+ * finished fragments to the output in record order. Workers only run a
+ * bounded number of chunks ahead of the output. The result is identical to
+ * serial output.
+ */
+void writeRecords(JsonWriter &writer, const tesparse::TESGameData &gameData, BinaryEncoding binaryEncoding, tesparse::StringEncoding stringEncoding, bool pretty, bool lines, size_t depth, unsigned int threads) {
+	static const size_t recordsPerChunk = 256;
+	static const size_t chunksAheadPerThread = 4;
+
+	auto recordCount = gameData.recordCount();
+
+	if (threads <= 1 || recordCount <= recordsPerChunk) {
+		ValueSerializer serializer(writer, binaryEncoding, stringEncoding);
+
+		for (size_t index = 0; index < recordCount; index++) {
+			serializer.writeRecord(gameData.recordType(index), &gameData.record(index));
+
+			if (lines)
+				writer.endLine();
+		}
+
+		return;
+	}
+
+	// Decoding on access is not thread-safe, so make sure everything is decoded
+	gameData.records();
+
+	auto chunkCount = (recordCount + recordsPerChunk - 1) / recordsPerChunk;
+	auto chunksAhead = threads * chunksAheadPerThread;
+
+	std::vector<std::string> fragments(chunkCount);
+	std::vector<bool> fragmentReady(chunkCount, false);
+	std::mutex mutex;
+	std::condition_variable fragmentDone, fragmentWritten;
+	size_t nextChunk = 0;
+	size_t writtenChunks = 0;
+	bool failed = false;
+	std::exception_ptr error;
+
+	auto worker = [&]() {
+		JsonWriter fragmentWriter(pretty);
+		ValueSerializer serializer(fragmentWriter, binaryEncoding, stringEncoding);
+
+		for (;;) {
+			size_t chunk;
 
-nlohmann::json convertValue(const std::vector<std::pair<std::string, std::unique_ptr<tesparse::TESStruct>>> &val) {
-	auto out = nlohmann::json::array();
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				fragmentWritten.wait(lock, [&]() {
+					return failed || nextChunk == chunkCount || nextChunk < writtenChunks + chunksAhead;
+				});
 
-	for (const auto &entry : val) {
-		out.push_back({
-			{ "type", entry.first },
-			{ "data", convertValue(entry.second) }
-		});
+				if (failed || nextChunk == chunkCount)
+					return;
+
+				chunk = nextChunk++;
+			}
+
+			std::string fragment;
+
+			try {
+				fragmentWriter.beginFragment(depth, chunk != 0);
+
+				for (size_t index = chunk * recordsPerChunk, end = std::min(recordCount, index + recordsPerChunk); index < end; index++) {
+					serializer.writeRecord(gameData.recordType(index), &gameData.record(index));
+
+					if (lines)
+						fragmentWriter.endLine();
+				}
+
+				fragment = fragmentWriter.takeBuffer();
+			}
+			catch (...) {
+				std::unique_lock<std::mutex> lock(mutex);
+				failed = true;
+				error = std::current_exception();
+				fragmentDone.notify_all();
+				fragmentWritten.notify_all();
+				return;
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				fragments[chunk] = std::move(fragment);
+				fragmentReady[chunk] = true;
+			}
+
+			fragmentDone.notify_all();
+		}
+	};
+
+	std::vector<std::thread> pool;
+	pool.reserve(threads);
+	for (unsigned int thread = 0; thread < threads; thread++) {
+		pool.emplace_back(worker);
 	}
 
-	return out;
+	try {
+		for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+			std::string fragment;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				fragmentDone.wait(lock, [&]() { return failed || fragmentReady[chunk]; });
+
+				if (failed)
+					break;
+
+				fragment = std::move(fragments[chunk]);
+				writtenChunks = chunk + 1;
+			}
+
+			fragmentWritten.notify_all();
+
+			writer.writeFragment(fragment);
+		}
+	}
+	catch (...) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!failed) {
+			failed = true;
+			error = std::current_exception();
+		}
+		fragmentWritten.notify_all();
+	}
+
+	for (auto &thread : pool) {
+		thread.join();
+	}
+
+	if (error)
+		std::rethrow_exception(error);
 }
 
 int main(int argc, char *argv[]) {
 	CLI::App app;
 
 	std::string descriptionFile;
+	std::string descriptionCacheFile;
 	std::string esmFile;
 	std::string jsonFile;
+	std::string format = "pretty";
+	unsigned int outputThreads = 1;
+	std::string binaryEncodingName = "hex";
+	std::string stringEncodingName;
+	std::vector<std::string> includeRecords;
+	std::vector<std::string> excludeRecords;
+	std::vector<std::string> projectedFields;
+	bool reportLayoutDrift = false;
+	tesparse::TESLoadOptions loadOptions;
 	app.add_option("description", descriptionFile)->mandatory();
 	app.add_option("input", esmFile)->mandatory();
 	app.add_option("output", jsonFile)->mandatory();
+	app.add_option("--description-cache", descriptionCacheFile, "Binary cache of the description file, which is rebuilt whenever the description changes");
+	app.add_flag("--populate", loadOptions.mapping.populate, "Prefault the whole input file into memory before parsing");
+	app.add_flag("--huge-pages", loadOptions.mapping.hugePages, "Request transparent huge pages for the input file mapping");
+	app.add_flag("--zero-copy", loadOptions.zeroCopy, "Reference strings and byte arrays in the input file instead of copying them");
+	app.add_option("--threads", loadOptions.threads, "Number of threads used to decode records (0 - one per hardware thread)", true);
+	app.add_option("--include", includeRecords, "Record types (FourCCs) to load; all if not specified");
+	app.add_option("--exclude", excludeRecords, "Record types (FourCCs) to skip");
+	app.add_option("--fields", projectedFields, "Fields to decode for a record type, as TYPE=Field,Array.Field,...; all if not specified for the type");
+	app.add_flag("--layout-drift", reportLayoutDrift, "Report subrecords whose size doesn't match the fixed layout in the description");
+	app.add_option("--output-threads", outputThreads, "Number of threads used to serialize records (0 - one per hardware thread)", true);
+	app.add_set("--format", format, { "pretty", "compact", "ndjson" }, "Output format: indented JSON, JSON without whitespace, or one record per line", true);
+	app.add_set("--string-encoding", stringEncodingName, { "UTF-8", "Windows-1252" }, "Encoding of string fields, overriding the one specified by the description file");
+	app.add_set("--binary-encoding", binaryEncodingName, { "hex", "base64" }, "Encoding of byte array fields", true);
 	
 	CLI11_PARSE(app, argc, argv);
 
+	try {
+		for (const auto &type : includeRecords) {
+			loadOptions.includeRecords.emplace_back(tesparse::fourCCFromString(type));
+		}
+
+		for (const auto &type : excludeRecords) {
+			loadOptions.excludeRecords.emplace_back(tesparse::fourCCFromString(type));
+		}
+	}
+	catch (const std::exception &e) {
+		fprintf(stderr, "Invalid record type: %s\n", e.what());
+		return 1;
+	}
+
+	try {
+		for (const auto &projection : projectedFields) {
+			auto separator = projection.find('=');
+			if (separator == std::string::npos)
+				throw std::runtime_error("expected TYPE=Field,...: " + projection);
+
+			auto &paths = loadOptions.projection[tesparse::fourCCFromString(projection.substr(0, separator))];
+
+			for (size_t start = separator + 1; start <= projection.size();) {
+				auto end = projection.find(',', start);
+				if (end == std::string::npos)
+					end = projection.size();
+
+				if (end != start)
+					paths.emplace_back(projection.substr(start, end - start));
+
+				start = end + 1;
+			}
+		}
+	}
+	catch (const std::exception &e) {
+		fprintf(stderr, "Invalid field projection: %s\n", e.what());
+		return 1;
+	}
+
 	tesparse::TESFileFormatDescription desc;
 	try {
-		desc.loadFromFile(descriptionFile);
+		if (descriptionCacheFile.empty())
+			desc.loadFromFile(descriptionFile);
+		else
+			desc.loadFromFile(descriptionFile, descriptionCacheFile);
 	}
 	catch (const std::exception &e) {
 		fprintf(stderr, "Description file has failed to load: %s\n", e.what());
@@ -104,28 +392,58 @@ int main(int argc, char *argv[]) {
 
 	tesparse::TESGameData gameData;
 	try {
-		gameData.load(esmFile, desc);
+		gameData.load(esmFile, desc, loadOptions);
 	}
 	catch (const std::exception &e) {
 		fprintf(stderr, "Parse error: %s\n", e.what());
 		return 1;
 	}
 
-	nlohmann::json json{
-		{ "header", convertValue(gameData.header()) },
-		{ "records", convertValue(gameData.records()) },
-	};
-
 //	try {
 		std::ofstream stream;
 		stream.exceptions(std::ios::badbit | std::ios::eofbit | std::ios::failbit);
 		stream.open(jsonFile, std::ios::out | std::ios::trunc | std::ios::binary);
-		stream << json.dump(2, ' ', false, nlohmann::json::error_handler_t::replace);
+
+		if (outputThreads == 0) {
+			outputThreads = std::max(1U, std::thread::hardware_concurrency());
+		}
+
+		auto binaryEncoding = binaryEncodingName == "base64" ? BinaryEncoding::Base64 : BinaryEncoding::Hex;
+		auto stringEncoding = stringEncodingName.empty() ? desc.stringEncoding() : tesparse::parseStringEncoding(stringEncodingName);
+		auto pretty = format == "pretty";
+		JsonWriter writer(stream, pretty);
+		ValueSerializer serializer(writer, binaryEncoding, stringEncoding);
+
+		if (format == "ndjson") {
+			serializer.writeRecord(desc.headerRecord(), gameData.header());
+			writer.endLine();
+
+			writeRecords(writer, gameData, binaryEncoding, stringEncoding, pretty, true, 0, outputThreads);
+		}
+		else {
+			writer.beginObject();
+			writer.key("header");
+			serializer.writeValue(gameData.header());
+			writer.key("records");
+			writer.beginArray();
+
+			writeRecords(writer, gameData, binaryEncoding, stringEncoding, pretty, false, 2, outputThreads);
+
+			writer.endArray();
+			writer.endObject();
+		}
+
+		writer.flush();
+
+		if (reportLayoutDrift) {
+			for (const auto &drift : gameData.layoutDrift()) {
+				fprintf(stderr, "layout drift: %s %s: expected %zu bytes, got %zu bytes in %zu subrecords\n",
+					tesparse::fourCCToString(drift.recordType).c_str(), tesparse::fourCCToString(drift.subrecordType).c_str(), drift.expectedSize, drift.actualSize, drift.count);
+			}
+		}
 //	}
 //	catch (const std::exception &e) {
 //		fprintf(stderr, "Unable to write JSON representation: %s\n", e.what());
 //		return 1;
 //	}
 }
-
-
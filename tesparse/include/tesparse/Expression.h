@@ -1,6 +1,8 @@
 #ifndef TESPARSE_EXPRESSION_H
 #define TESPARSE_EXPRESSION_H
 
+#include <stdint.h>
+
 #include <vector>
 #include <variant>
 #include <string>
@@ -2,28 +2,56 @@
 #define TESPARSE_EXPRESSION_EVALUATOR_H
 
 #include <tesparse/Expression.h>
+#include <tesparse/TESValue.h>
 
 namespace tesparse {
-	struct TESStruct;
+	enum class ExpressionStepKind : uint8_t {
+		Constant,
+		Variable,
+		Operator
+	};
+
+	struct ExpressionStep {
+		ExpressionStepKind kind;
+		ExpressionOperator op; // Operator only
+		ExpressionInteger constant; // Constant only
+		TESFieldSlot slot; // Variable only: slot in the context struct's layout
+	};
+
+	/*
+	 * Postfix expression with constant subexpressions folded and variables
+	 * bound to slots of the layout it is evaluated against. The stack depth
+	 * is checked when compiling, so evaluation needs no checks of its own.
+	 */
+	struct CompiledExpression {
+		std::vector<ExpressionStep> steps;
+	};
 
 	class ExpressionEvaluator {
 	public:
+		static constexpr size_t MaxStackDepth = 16;
+
 		ExpressionEvaluator();
 		~ExpressionEvaluator();
 
 		ExpressionEvaluator(const ExpressionEvaluator &other) = delete;
 		ExpressionEvaluator &operator =(const ExpressionEvaluator &other) = delete;
 
-		ExpressionInteger evaluate(const Expression &expression, const TESStruct &context);
+		/*
+		 * Variables are bound to fields already defined in the layout, which
+		 * are the fields decoded before the expression is evaluated; any
+		 * other name is an error in the description.
+		 */
+		static CompiledExpression compile(const Expression &expression, const TESStructLayout &layout);
 
-	private:
-		void execute(ExpressionOperator op, const TESStruct &context);
-		void execute(ExpressionInteger val, const TESStruct &context);
-		void execute(const std::string &variable, const TESStruct &context);
+		ExpressionInteger evaluate(const CompiledExpression &expression, const TESStruct &context);
 
-		ExpressionInteger popStack();
+	private:
+		static bool traps(ExpressionOperator op, ExpressionInteger left, ExpressionInteger right);
+		static ExpressionInteger apply(ExpressionOperator op, ExpressionInteger left, ExpressionInteger right);
+		static ExpressionInteger variableValue(const TESStruct &context, TESFieldSlot slot);
 
-		std::vector<uint32_t> m_stack;
+		ExpressionInteger m_stack[MaxStackDepth];
 	};
 }
 
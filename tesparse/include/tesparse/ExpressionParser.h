@@ -19,6 +19,22 @@ namespace tesparse {
 	private:
 		static unsigned int operatorPrecedence(ExpressionOperator op);
 
+		static inline bool isSpace(char ch) {
+			return ch == ' ' || (ch >= '\t' && ch <= '\r');
+		}
+
+		static inline bool isDigit(char ch) {
+			return ch >= '0' && ch <= '9';
+		}
+
+		static inline bool isHexDigit(char ch) {
+			return isDigit(ch) || (ch >= 'A' && ch <= 'F') || (ch >= 'a' && ch <= 'f');
+		}
+
+		static inline bool isIdentifierStart(char ch) {
+			return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == '_';
+		}
+
 		Expression m_expression;
 		std::vector<ExpressionOperator> m_operatorStack;
 	};
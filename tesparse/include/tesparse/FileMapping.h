@@ -2,30 +2,62 @@
 #define TESPARSE_FILE_MAPPING_H
 
 #include <string_view>
+#include <memory>
 
+#ifdef _WIN32
 #include <tesparse/WindowsHandle.h>
+#else
+#include <tesparse/PosixFileDescriptor.h>
+#endif
 
 namespace tesparse {
+	/*
+	 * Access pattern hints passed to the OS when the file is mapped. All of
+	 * these are advisory: a platform that doesn't support a hint ignores it.
+	 */
+	struct FileMappingOptions {
+		bool sequential = false;	// the mapping will be read front to back once
+		bool willNeed = false;		// start read-ahead of the whole file immediately
+		bool populate = false;		// prefault all pages before returning from the constructor
+		bool hugePages = false;		// back the mapping with transparent huge pages where possible
+		bool writable = false;		// map the file for writing: changes through writableBase() go to the file
+	};
+
 	class FileMapping {
 	public:
-		FileMapping(const std::string_view &filename);
+		explicit FileMapping(const std::string_view &filename, const FileMappingOptions &options = FileMappingOptions());
 		~FileMapping();
 
 		FileMapping(const FileMapping &other) = delete;
 		FileMapping &operator =(const FileMapping &other) = delete;
 
 		inline const void *base() const { return m_mapping.get(); }
-		inline const size_t size() const { return m_size; }
+		inline size_t size() const { return m_size; }
+		inline bool writable() const { return m_writable; }
+
+		void *writableBase();
+
+		// Writes changes made through writableBase() back to the file
+		void flush();
 
 	private:
 		struct MappingDeleter {
+#ifndef _WIN32
+			size_t size;
+#endif
+
 			void operator()(void *base) const;
 		};
 
+#ifdef _WIN32
 		WindowsHandle m_fileHandle;
 		WindowsHandle m_sectionHandle;
+#else
+		PosixFileDescriptor m_fileDescriptor;
+#endif
 		std::unique_ptr<void, MappingDeleter> m_mapping;
 		size_t m_size;
+		bool m_writable;
 	};
 }
 
@@ -2,8 +2,9 @@
 #define TESPARSE_FOURCC_H
 
 #include <stdint.h>
+#include <string>
 #include <string_view>
-#include <unordered_set>
+#include <vector>
 
 namespace tesparse {
 	uint32_t fourCCFromString(const std::string_view &string);
@@ -3,6 +3,9 @@
 
 #include <tesparse/SerializationStream.h>
 
+#include <algorithm>
+#include <cstring>
+
 namespace tesparse {
 	class InputSerializationStream final : public SerializationStream {
 	public:
@@ -17,11 +20,59 @@ namespace tesparse {
 
 		virtual size_t remainingSize() const override;
 
+		/*
+		 * Non-virtual counterparts of the reads above, for callers that know
+		 * they have an InputSerializationStream: each inlines to a bounds check
+		 * and a load. With Checked unset, the bounds check is left out too; the
+		 * caller must have checked remaining() for the whole run of reads.
+		 */
+		template<bool Checked = true>
+		inline const unsigned char *readRegion(size_t size) {
+			if (Checked && size > static_cast<size_t>(m_end - m_ptr))
+				throwOutOfBounds();
+
+			auto ptr = m_ptr;
+			m_ptr += size;
+			return ptr;
+		}
+
+		inline size_t remaining() const {
+			return static_cast<size_t>(m_end - m_ptr);
+		}
+
+		inline bool finished() const {
+			return m_ptr == m_end;
+		}
+
+		template<typename T, bool Checked = true>
+		inline T read() {
+			static_assert(std::is_arithmetic<T>::value, "only arithmetic types can be read");
+
+			T value;
+			auto region = readRegion<Checked>(sizeof(T));
+
+			if (swapEndian())
+				std::reverse_copy(region, region + sizeof(T), reinterpret_cast<unsigned char *>(&value));
+			else
+				memcpy(&value, region, sizeof(T));
+
+			return value;
+		}
+
 	private:
+		[[noreturn]] static void throwOutOfBounds();
+
 		const unsigned char *m_begin;
 		const unsigned char *m_end;
 		const unsigned char *m_ptr;
 	};
+
+	// Preferred over the SerializationStream overload, bypassing the virtual interface
+	template<typename T>
+	inline typename std::enable_if<std::is_arithmetic<T>::value, InputSerializationStream &>::type operator >>(InputSerializationStream &stream, T &value) {
+		value = stream.read<T>();
+		return stream;
+	}
 }
 
 #endif
@@ -3,9 +3,23 @@
 
 #include <tesparse/SerializationStream.h>
 
+#include <memory>
+#include <string_view>
 #include <vector>
 
 namespace tesparse {
+	/*
+	 * Output is buffered in blocks that are never reallocated, so regions
+	 * returned by getRegionForWrite stay valid until the stream is destroyed,
+	 * and growing the output never copies what was already written. Block
+	 * sizes grow geometrically with the output, unless reserve() is used to
+	 * announce how much is coming.
+	 *
+	 * The output is a sequence of segments, each contiguous in memory: the
+	 * data written into a block, and the external data appended with
+	 * writeExternal(). writeToFile() writes the segments with scatter/gather
+	 * I/O, without joining them first.
+	 */
 	class OutputSerializationStream final : public SerializationStream {
 	public:
 		OutputSerializationStream();
@@ -17,16 +31,49 @@ namespace tesparse {
 
 		virtual size_t getCurrentPosition() const override;
 		virtual void setCurrentPosition(size_t position) override;
-		
-		inline std::vector<unsigned char> &&data() { return std::move(m_data); }
+
+		// Contents of the stream, copied into one contiguous buffer
+		std::vector<unsigned char> data() const;
 
 		virtual size_t remainingSize() const override;
 
+		// Makes sure that the next 'size' bytes appended fit into one block
+		void reserve(size_t size);
+
+		/*
+		 * Appends data without copying it. The data must stay valid and
+		 * unchanged for the lifetime of the stream, and can't be overwritten
+		 * through the stream.
+		 */
+		void writeExternal(const unsigned char *data, size_t size);
+
+		// Creates or truncates the file and writes the contents of the stream to it
+		void writeToFile(const std::string_view &filename) const;
+
 	private:
-		std::vector<unsigned char> m_data;
+		static constexpr size_t MinimumBlockSize = 4096;
+		static constexpr size_t MaximumBlockSize = 64 * 1024 * 1024;
+
+		struct Segment {
+			unsigned char *data; // const for external segments
+			size_t position; // stream position of the first byte
+			size_t size;
+			bool external;
+		};
+
+		const Segment &findSegment(size_t position) const;
+		unsigned char *append(size_t size);
+		void allocateBlock(size_t size);
+
 		SerializationStream *m_targetStream;
 		size_t m_position;
 		size_t m_offset;
+
+		std::vector<Segment> m_segments;
+		std::vector<std::unique_ptr<unsigned char[]>> m_blocks;
+		unsigned char *m_blockFree; // first unused byte of the last block
+		size_t m_blockRemaining;
+		size_t m_size;
 	};
 }
 
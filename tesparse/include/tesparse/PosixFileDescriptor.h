@@ -0,0 +1,37 @@
+#ifndef TESPARSE_POSIX_FILE_DESCRIPTOR_H
+#define TESPARSE_POSIX_FILE_DESCRIPTOR_H
+
+namespace tesparse {
+	class PosixFileDescriptor {
+	public:
+		inline PosixFileDescriptor() noexcept : m_fd(-1) {}
+		inline explicit PosixFileDescriptor(int fd) noexcept : m_fd(fd) {}
+		inline ~PosixFileDescriptor() { reset(); }
+
+		PosixFileDescriptor(const PosixFileDescriptor &other) = delete;
+		PosixFileDescriptor &operator =(const PosixFileDescriptor &other) = delete;
+
+		inline PosixFileDescriptor(PosixFileDescriptor &&other) noexcept : m_fd(other.release()) {}
+
+		inline PosixFileDescriptor &operator =(PosixFileDescriptor &&other) noexcept {
+			reset(other.release());
+			return *this;
+		}
+
+		inline int get() const noexcept { return m_fd; }
+		inline explicit operator bool() const noexcept { return m_fd >= 0; }
+
+		inline int release() noexcept {
+			auto fd = m_fd;
+			m_fd = -1;
+			return fd;
+		}
+
+		void reset(int fd = -1) noexcept;
+
+	private:
+		int m_fd;
+	};
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 
+#include <array>
 #include <type_traits>
 #include <vector>
 #include <string>
@@ -61,7 +62,7 @@ namespace tesparse {
 
 	template<typename T>
 	typename std::enable_if<std::is_enum<T>::value, SerializationStream &>::type operator <<(SerializationStream &stream, T value) {
-		return stream << static_cast<std::underlying_type<T>::type>(value);
+		return stream << static_cast<typename std::underlying_type<T>::type>(value);
 	}
 	
 	template<typename T>
@@ -6,9 +6,30 @@
 
 namespace tesparse {
 
+	enum class StringEncoding {
+		UTF8,
+		Windows1252
+	};
+
+	// Accepts the names used by description files: UTF-8, Windows-1252
+	StringEncoding parseStringEncoding(const std::string_view &name);
+
+#ifdef _WIN32
+	// For file names passed to the Windows API
 	std::wstring utf8ToWide(const std::string_view &string);
 
 	std::string wideToUtf8(const std::wstring_view &string);
+#endif
+
+	// Number of leading bytes of the string that are 7-bit ASCII
+	size_t asciiPrefixLength(const char *data, size_t size);
+
+	/*
+	 * Replaces the contents of 'output' with the UTF-8 form of a Windows-1252
+	 * string. The five bytes that Windows-1252 leaves undefined map to the C1
+	 * control characters of the same value, as Windows itself does.
+	 */
+	void windows1252ToUtf8(const std::string_view &string, std::string &output);
 
 }
 
@@ -0,0 +1,106 @@
+#ifndef TESPARSE_SUBRECORD_STATE_MACHINE_H
+#define TESPARSE_SUBRECORD_STATE_MACHINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace tesparse {
+	struct RecordDefinition;
+	struct SubrecordDefinition;
+	struct SubrecordArrayDefinition;
+
+	enum class SubrecordAction : uint8_t {
+		Subrecord,		// subrecord at the record level
+		ArraySubrecord	// subrecord inside of a subrecord array member
+	};
+
+	struct SubrecordTransition {
+		SubrecordAction action;
+		bool openArray;		// ArraySubrecord only: the array is being (re)entered, look up its field
+		bool pushMember;	// ArraySubrecord only: this subrecord starts a new array member
+		uint32_t nextState;
+		const SubrecordDefinition *subrecord;
+		const SubrecordArrayDefinition *array; // ArraySubrecord only
+		size_t arraySlot; // ArraySubrecord only: slot of the array in the record layout
+	};
+
+	/*
+	 * Subrecord matching for one RecordDefinition, precomputed into a table
+	 * keyed by (state, FourCC). A state is a position in the record's entries,
+	 * plus a position in the array's subrecords while inside of an array.
+	 *
+	 * Transitions are derived by running the reference matching algorithm
+	 * (see simulate()) for every state and every FourCC the record mentions,
+	 * so the table accepts exactly what that algorithm accepts. FourCCs that
+	 * are absent from the table are errors, and describeError() re-runs the
+	 * algorithm to produce the diagnostic.
+	 */
+	class SubrecordStateMachine {
+	public:
+		static constexpr uint32_t InitialState = 0;
+
+		SubrecordStateMachine();
+		~SubrecordStateMachine();
+
+		void build(const RecordDefinition &record);
+
+		inline const SubrecordTransition *transition(uint32_t state, uint32_t fourcc) const {
+			auto it = m_transitions.find(transitionKey(state, fourcc));
+			if (it == m_transitions.end())
+				return nullptr;
+
+			return &it->second;
+		}
+
+		inline uint32_t stateCount() const { return static_cast<uint32_t>(m_states.size()); }
+
+		/*
+		 * Runs the reference matching algorithm for one state and FourCC, for
+		 * checking the table against it. Returns false if the algorithm
+		 * rejects the subrecord.
+		 */
+		bool referenceTransition(const RecordDefinition &record, uint32_t state, uint32_t fourcc, SubrecordTransition &transition) const;
+
+		std::string describeError(const RecordDefinition &record, uint32_t state, uint32_t fourcc, const std::string &chain) const;
+
+	private:
+		struct State {
+			size_t position;
+			ptrdiff_t arrayPosition; // -1 if not inside of an array
+		};
+
+		enum class Outcome {
+			Transition,
+			ExpectedEOF,
+			EarlyArrayRestart,
+			UnexpectedSubrecord
+		};
+
+		struct SimulationResult {
+			Outcome outcome;
+			SubrecordTransition transition;
+
+			// Error only: matching position at the time of the failure
+			size_t position;
+			const SubrecordArrayDefinition *currentArray;
+			size_t arrayPosition;
+		};
+
+		static inline uint64_t transitionKey(uint32_t state, uint32_t fourcc) {
+			return (static_cast<uint64_t>(state) << 32) | fourcc;
+		}
+
+		uint32_t stateId(size_t position, ptrdiff_t arrayPosition) const;
+		SimulationResult simulate(const RecordDefinition &record, uint32_t state, uint32_t fourcc) const;
+
+		std::vector<State> m_states;
+		std::vector<uint32_t> m_arrayStateBase; // per entry: id of (position, 0) if the entry is an array
+		std::unordered_map<uint64_t, SubrecordTransition> m_transitions;
+	};
+}
+
+#endif
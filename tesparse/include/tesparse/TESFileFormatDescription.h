@@ -8,15 +8,14 @@
 #include <memory>
 #include <variant>
 #include <unordered_set>
-
-#include <Windows.h>
-#include <Shlwapi.h>
-#include <comdef.h>
-#include <xmllite.h>
+#include <limits>
 
 #include <tesparse/Expression.h>
-
-_COM_SMARTPTR_TYPEDEF(IXmlReader, IID_IXmlReader);
+#include <tesparse/ExpressionEvaluator.h>
+#include <tesparse/SubrecordStateMachine.h>
+#include <tesparse/TESValue.h>
+#include <tesparse/StringConversions.h>
+#include <tesparse/XmlPullParser.h>
 
 namespace tesparse {
 	enum class FieldType {
@@ -33,11 +32,59 @@ namespace tesparse {
 		StructRef
 	};
 
+	struct DecodingProgram;
+	class SerializationStream;
+
+	enum class DecodingOpcode : uint8_t {
+		UInt32, // FourCC and UInt32
+		Int8,
+		UInt8,
+		UInt16,
+		Int32,
+		Float,
+		ByteArray,
+		String,
+		Array,
+		Struct
+	};
+
+	enum class LengthSource : uint8_t {
+		Remaining, // until the end of the enclosing data
+		Constant,
+		Expression
+	};
+
+	/*
+	 * One field of a compiled layout. Array elements are stored inline: the
+	 * element instruction immediately follows its Array instruction, and
+	 * 'span' is the number of instructions the field occupies including its
+	 * element, so the next field is always at 'this + span'.
+	 */
+	struct DecodingInstruction {
+		static constexpr size_t VariableSize = std::numeric_limits<size_t>::max();
+
+		DecodingOpcode opcode;
+		LengthSource lengthSource; // ByteArray, String, Array only
+		size_t span;
+		size_t fixedSize; // encoded size in bytes, or VariableSize
+		TESFieldSlot slot; // slot in the enclosing struct's layout; unused for array elements
+		ExpressionInteger constantLength; // LengthSource::Constant only
+		const CompiledExpression *lengthExpression; // LengthSource::Expression only
+		const DecodingProgram *structProgram; // Struct only
+		const TESStructLayout *structLayout; // Struct only
+	};
+
+	struct DecodingProgram {
+		std::vector<DecodingInstruction> instructions;
+		size_t fixedSize = DecodingInstruction::VariableSize;
+	};
+
 	struct FieldDefinition {
 		std::string name;
 		FieldType type;
 
 		Expression length; // ByteArray, String, Array only: length expression. If empty, then until EOF
+		CompiledExpression compiledLength; // bound to the layout of the enclosing struct
 
 		std::string structName; // StructRef only
 
@@ -46,23 +93,30 @@ namespace tesparse {
 
 	struct StructDefinition {
 		std::vector<FieldDefinition> fields;
+		TESStructLayout layout;
+		DecodingProgram program;
 	};
 
 	struct SubrecordDefinition {
 		uint32_t fourcc;
 		bool required;
 		std::vector<FieldDefinition> fields;
+		DecodingProgram program;
 	};
 
 	struct SubrecordArrayDefinition {
 		std::string name;
 		std::vector<uint32_t> leader;
 		std::vector<SubrecordDefinition> subrecords;
+		TESStructLayout memberLayout; // fields of all subrecords of one array member
 	};
 
 	struct RecordDefinition {
+		uint32_t fourcc;
 		std::string name;
 		std::vector<std::variant<SubrecordDefinition, SubrecordArrayDefinition>> entries;
+		TESStructLayout layout; // fields of the Record structure, followed by fields of all top-level subrecords and arrays
+		SubrecordStateMachine stateMachine;
 	};
 
 	class TESFileFormatDescription {
@@ -74,32 +128,75 @@ namespace tesparse {
 		TESFileFormatDescription &operator =(const TESFileFormatDescription &other) = delete;
 
 		void loadFromFile(const std::string_view &filename);
+
+		/*
+		 * Loads an XML description through a binary cache file. If the cache
+		 * was made from XML with the same content hash, it is loaded instead
+		 * of parsing the XML; otherwise the XML is parsed and the cache is
+		 * written anew.
+		 */
+		void loadFromFile(const std::string_view &filename, const std::string_view &cacheFilename);
+
+		// Accepts both the XML and the binary form of a description
 		void loadFromMemory(const unsigned char *data, unsigned int dataSize);
 
+		/*
+		 * Binary form of the loaded description, as stored in cache files.
+		 * It can also be embedded into an executable and passed to
+		 * loadFromMemory.
+		 */
+		std::vector<unsigned char> serialize() const;
+
+		// FNV-1a hash of XML source text, which the binary form is keyed by
+		static uint64_t contentHash(const unsigned char *data, size_t size);
+
 		const StructDefinition &getStructByName(const std::string &name) const;
 		const RecordDefinition *tryGetRecordByFourCC(uint32_t fourcc) const;
 
 		inline const std::string &headerRecord() const { return m_headerRecord; }
 
+		// Encoding of String fields in the data files
+		inline StringEncoding stringEncoding() const { return m_stringEncoding; }
+
 	private:
-		void parseStream(IStreamPtr &&stream);
+		static const uint32_t BinaryVersion = 1;
+		static const size_t BinaryHeaderSize = 20;
+
+		void clear();
+		void parseDocument(const unsigned char *data, size_t dataSize);
+
+		static bool readBinaryHeader(const unsigned char *data, size_t dataSize, uint64_t &sourceHash);
+		void loadBinary(const unsigned char *data, size_t dataSize);
+		void writeCache(const std::string_view &cacheFilename) const;
+		static void serializeFields(SerializationStream &stream, const std::vector<FieldDefinition> &fields);
+		static void serializeField(SerializationStream &stream, const FieldDefinition &field);
+		static void serializeSubrecord(SerializationStream &stream, const SubrecordDefinition &subrecord);
+		static void deserializeFields(SerializationStream &stream, std::vector<FieldDefinition> &fields);
+		static void deserializeField(SerializationStream &stream, FieldDefinition &field);
+		static void deserializeSubrecord(SerializationStream &stream, SubrecordDefinition &subrecord);
 		
-		void checkHR(HRESULT hr);
-		std::wstring_view getLocalName(const IXmlReaderPtr &reader);
-		void expectElement(const IXmlReaderPtr &reader, const std::wstring_view &name);
-		void readAndExpectType(const IXmlReaderPtr &reader, XmlNodeType expectedType);
-		bool iterateOnChildElements(const IXmlReaderPtr &reader);
-		std::wstring_view getNamedAttribute(const IXmlReaderPtr &reader, const std::wstring &attributeName);
-		void expectEmptyElement(const IXmlReaderPtr &reader);
-		void expectNonEmptyElement(const IXmlReaderPtr &reader);
-		void parseStruct(const IXmlReaderPtr &reader);
-		void parseFields(const IXmlReaderPtr &reader, std::vector<FieldDefinition> &fields);
-		void parseField(const IXmlReaderPtr &reader, FieldDefinition &field);
-		void parseRecord(const IXmlReaderPtr &reader);
-		void parseSubrecord(const IXmlReaderPtr &reader, SubrecordDefinition &definition);
-		void parseSubrecordArray(const IXmlReaderPtr &reader, SubrecordArrayDefinition &definition);
+		void expectElement(XmlPullParser &reader, const std::string_view &name);
+		void readAndExpectType(XmlPullParser &reader, XmlNodeType expectedType);
+		bool iterateOnChildElements(XmlPullParser &reader);
+		std::string_view getNamedAttribute(const XmlPullParser &reader, const std::string_view &attributeName);
+		bool tryGetNamedAttribute(const XmlPullParser &reader, const std::string_view &attributeName, std::string_view &value);
+		void expectEmptyElement(XmlPullParser &reader);
+		void expectNonEmptyElement(XmlPullParser &reader);
+		void parseStruct(XmlPullParser &reader);
+		void parseFields(XmlPullParser &reader, std::vector<FieldDefinition> &fields);
+		void parseField(XmlPullParser &reader, FieldDefinition &field);
+		void parseRecord(XmlPullParser &reader);
+		void parseSubrecord(XmlPullParser &reader, SubrecordDefinition &definition);
+		void parseSubrecordArray(XmlPullParser &reader, SubrecordArrayDefinition &definition);
+
+		void compile();
+		void compileStruct(StructDefinition &definition, std::unordered_set<const StructDefinition *> &compiling);
+		void compileFields(std::vector<FieldDefinition> &fields, DecodingProgram &program, TESStructLayout &layout, std::unordered_set<const StructDefinition *> &compiling);
+		size_t compileField(FieldDefinition &field, TESFieldSlot slot, DecodingProgram &program, TESStructLayout &layout, std::unordered_set<const StructDefinition *> &compiling);
 
 		std::string m_headerRecord;
+		StringEncoding m_stringEncoding;
+		uint64_t m_sourceHash;
 		std::unordered_map<std::string, StructDefinition> m_structs;
 		std::unordered_map<uint32_t, RecordDefinition> m_records;
 	};
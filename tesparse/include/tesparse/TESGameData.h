@@ -2,14 +2,106 @@
 #define TESPARSE_TES_GAME_DATA_H
 
 #include <string_view>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <tesparse/TESValue.h>
+#include <tesparse/FileMapping.h>
+#include <tesparse/Expression.h>
 
 namespace tesparse {
 	class TESFileFormatDescription;
+	class InputSerializationStream;
 	class SerializationStream;
+	struct RecordDefinition;
+	struct SubrecordDefinition;
+	struct SubrecordArrayDefinition;
 	struct FieldDefinition;
+	struct DecodingProgram;
+	struct DecodingInstruction;
+	class ExpressionEvaluator;
+
+	struct TESLoadOptions {
+		/*
+		 * load() reads the file front to back exactly once, so sequential
+		 * read-ahead is requested by default. mapping.writable maps the file
+		 * for writing, for patchField(); the file then also stays mapped for
+		 * the lifetime of TESGameData.
+		 */
+		FileMappingOptions mapping{ true, true, false, false };
+
+		/*
+		 * If set, ByteArray and String fields are stored as TESByteArrayView
+		 * and std::string_view referencing the mapped file instead of owned
+		 * copies, and the file stays mapped for the lifetime of TESGameData.
+		 */
+		bool zeroCopy = false;
+
+		/*
+		 * If set, load() only reads the record framing and builds an index of
+		 * record offsets. Each record is decoded on its first access through
+		 * record() or records(), and the file stays mapped for the lifetime of
+		 * TESGameData. Decoding on access is not thread-safe.
+		 */
+		bool lazy = false;
+
+		/*
+		 * If set, the file stays mapped for the lifetime of TESGameData, so
+		 * that save() can copy records that were not modified from it byte for
+		 * byte, which save() requires. The file also stays mapped in zeroCopy
+		 * and lazy modes.
+		 */
+		bool passthrough = false;
+
+		/*
+		 * Number of threads used to decode records. 1 decodes on the calling
+		 * thread, 0 uses one thread per hardware thread. Ignored in lazy mode.
+		 */
+		unsigned int threads = 1;
+
+		/*
+		 * Record type filter, as FourCCs. If includeRecords is not empty, only
+		 * the listed record types are loaded; record types listed in
+		 * excludeRecords are never loaded. Filtered records are stepped over
+		 * by their Size without decoding. The header record is always loaded.
+		 */
+		std::vector<uint32_t> includeRecords;
+		std::vector<uint32_t> excludeRecords;
+
+		/*
+		 * Field projection, by record type FourCC. Only the listed fields of
+		 * records of these types are materialized; fields of subrecord array
+		 * members are named as Array.Field, and naming a field selects its
+		 * whole value. Subrecords that hold no listed field are stepped over
+		 * without decoding. Record types that are not listed are decoded
+		 * completely.
+		 */
+		std::unordered_map<uint32_t, std::vector<std::string>> projection;
+	};
+
+	/*
+	 * Subrecords of one type whose size differs from the static size of
+	 * their layout in the description.
+	 */
+	struct TESLayoutDrift {
+		uint32_t recordType; // FourCC
+		uint32_t subrecordType; // FourCC
+		size_t expectedSize;
+		size_t actualSize;
+		size_t count;
+	};
+
+	// Byte range of a field in the source file
+	struct TESFieldLocation {
+		size_t offset;
+		size_t size;
+	};
 
 	class TESGameData {
 	public:
@@ -19,18 +111,201 @@ namespace tesparse {
 		TESGameData(const TESGameData &other) = delete;
 		TESGameData &operator =(const TESGameData &other) = delete;
 
-		void load(const std::string_view &filename, const tesparse::TESFileFormatDescription &desc);
+		void load(const std::string_view &filename, const tesparse::TESFileFormatDescription &desc, const TESLoadOptions &options = TESLoadOptions());
+
+		/*
+		 * All decoded values are allocated from arenas owned by TESGameData
+		 * and are released at once, without running their destructors, when
+		 * TESGameData is destroyed or loads another file.
+		 */
+		inline const TESStruct *header() const { return m_header; }
+
+		inline size_t recordCount() const { return m_records.size(); }
+		inline const std::string &recordType(size_t index) const { return m_records.at(index).first; }
+		const TESStruct &record(size_t index) const;
 
-		inline const std::unique_ptr<TESStruct> &header() const { return m_header; }
-		inline const std::vector<std::pair<std::string, std::unique_ptr<TESStruct>>> &records() const { return m_records; }
+		// In lazy mode, decodes all records that were not accessed yet.
+		const std::vector<std::pair<std::string, const TESStruct *>> &records() const;
+
+		/*
+		 * Size mismatches of fixed-layout subrecords in the records decoded so
+		 * far, ordered by record type, subrecord type and size.
+		 */
+		std::vector<TESLayoutDrift> layoutDrift() const;
+
+		/*
+		 * Mutable access to a record, which marks it as modified. Records
+		 * loaded with a field projection can't be modified. Values assigned
+		 * to a record should be allocated from memoryResource(), as the
+		 * destructors of record values are never run.
+		 */
+		TESStruct &modifyRecord(size_t index);
+		TESStruct &modifyHeader();
+		std::pmr::memory_resource *memoryResource() const;
+
+		/*
+		 * Writes the header and all records to a file in the format of the
+		 * description. Saving requires the source file to stay mapped (see
+		 * TESLoadOptions::passthrough): records that were not modified, were
+		 * filtered out or are of unknown types are copied from it unchanged,
+		 * and modified records are encoded from their values.
+		 *
+		 * Encoding is the reverse of decoding: the Size of every record and
+		 * subrecord is computed from the values, and a subrecord is written
+		 * if any of its fields is present (or, for subrecords without fields,
+		 * if it is required), in description order; descriptions can't define
+		 * a field name in more than one subrecord of a record, so a present
+		 * field always belongs to a subrecord that was read. String fields
+		 * that extend to the end of their subrecord are written
+		 * zero-terminated, and those of a fixed length are zero-padded.
+		 * Lengths given by expressions aren't updated: the values must match
+		 * them.
+		 *
+		 * Decoding doesn't keep everything: bytes after the terminator of a
+		 * string, a missing terminator, the contents of subrecords without
+		 * fields and trailing bytes of subrecords that are larger than their
+		 * layout. A subrecord of a modified record whose values are unchanged
+		 * is therefore copied from the source file; one whose values changed is
+		 * encoded, unless its source bytes aren't what its decoded values
+		 * encode to, in which case save() throws rather than lose data.
+		 * Subrecords of array members are matched with the source by member
+		 * index.
+		 */
+		void save(const std::string_view &filename) const;
+
+		/*
+		 * Locates a fixed-size field of a record in the source file, using the
+		 * description and the subrecord headers only. A path is a field name,
+		 * followed by '.Field' for fields of structures and '[index]' for
+		 * elements of arrays and members of subrecord arrays, as in "Weight",
+		 * "Items[2].Count" or "Position.X". Fields of the Record structure
+		 * other than Name, Size and Data, such as flags, are located in the
+		 * record header.
+		 * Where a subrecord occurs several times, the first one holds the
+		 * field, as in decoding. The offset of the field within its subrecord
+		 * must not depend on variable-size fields. locateHeaderField() locates
+		 * fields of the header record.
+		 */
+		TESFieldLocation locateField(size_t index, const std::string_view &path) const;
+		TESFieldLocation locateHeaderField(const std::string_view &path) const;
+
+		/*
+		 * Overwrites a field located as by locateField() in the mapping of a
+		 * file loaded with mapping.writable. The value is encoded as by save(),
+		 * and has to take up exactly the size of the field, so the sizes of
+		 * the record and the subrecord never change. Values of records that
+		 * were already decoded aren't updated. The file is updated as the OS
+		 * writes the mapping back, or on flush(). patchHeaderField() patches
+		 * fields of the header record.
+		 */
+		void patchField(size_t index, const std::string_view &path, const TESValue &value);
+		void patchHeaderField(const std::string_view &path, const TESValue &value);
+		void flush();
 
 	private:
-		void parseFields(SerializationStream &stream, const std::vector<FieldDefinition> &fields, TESStruct &record);
-		TESValue parseFieldValue(SerializationStream &stream, const FieldDefinition &field, const TESStruct &context);
+		struct FieldMask {
+			std::vector<bool> selected; // by layout slot
+			std::vector<bool> decoded; // selected, or needed to evaluate length expressions
+			bool hasUnselectedDecoded;
+		};
+
+		struct ArrayProjection {
+			TESFieldSlot slot;
+			FieldMask members;
+		};
+
+		struct RecordProjection {
+			FieldMask fields;
+			std::unordered_map<const SubrecordArrayDefinition *, ArrayProjection> arrays; // arrays that are not listed are skipped
+			std::unordered_set<const SubrecordDefinition *> skippedSubrecords;
+		};
+
+		struct RecordIndexEntry {
+			size_t offset;
+			size_t size;
+			const RecordDefinition *definition;
+			const RecordProjection *projection;
+		};
+
+		/*
+		 * A modified record as it was decoded from the source file, with the
+		 * data of its subrecords by definition and array member index.
+		 */
+		struct RecordOrigin {
+			static constexpr size_t NoMember = static_cast<size_t>(-1);
+
+			const TESStruct *values;
+			std::map<std::pair<const SubrecordDefinition *, size_t>, TESByteArrayView> subrecords;
+		};
+
+		struct SubrecordOrigin {
+			TESByteArrayView data;
+			const TESStruct *values; // the structure that holds the subrecord's fields
+		};
+
+		// A record that was filtered out or is of an unknown type
+		struct SkippedRecord {
+			size_t position; // number of loaded records before it, counting the header
+			RecordIndexEntry entry;
+		};
+
+		void buildProjections(const TESLoadOptions &options);
+		static void collectExpressionVariables(const std::vector<FieldDefinition> &fields, std::unordered_set<std::string> &variables);
+		static void finishFieldMask(FieldMask &mask, const TESStructLayout &layout, const std::unordered_set<std::string> &expressionVariables);
+		static void clearUnselectedFields(TESStruct &st, const FieldMask &mask);
+		void indexRecords(const TESLoadOptions &options);
+		void decodeRecordsParallel(unsigned int threads);
+		std::pmr::memory_resource *createArena();
+		const TESStruct *decodeRecord(const RecordIndexEntry &entry, std::pmr::memory_resource *arena, RecordOrigin *origin = nullptr) const;
+		std::string describeSubrecordChain(const unsigned char *data, size_t size) const;
+		void parseSubrecord(InputSerializationStream &stream, uint32_t recordType, const SubrecordDefinition &subrecord, TESStruct &record, const std::vector<bool> *decodedFields, std::pmr::memory_resource *arena, ExpressionEvaluator &evaluator) const;
+		void recordLayoutDrift(uint32_t recordType, uint32_t subrecordType, size_t expectedSize, size_t actualSize) const;
+		const DecodingInstruction *resolveFieldPath(const RecordIndexEntry &entry, const std::string_view &path, size_t &offset) const;
+		void patchRecordField(const RecordIndexEntry &entry, const std::string_view &path, const TESValue &value);
+		size_t encodeRecord(SerializationStream *stream, const RecordDefinition &record, const TESStruct &contents, const RecordOrigin &origin, ExpressionEvaluator &evaluator) const;
+		size_t encodeSubrecords(SerializationStream *stream, const RecordDefinition &record, const TESStruct &contents, const RecordOrigin &origin, ExpressionEvaluator &evaluator) const;
+		size_t encodeSubrecord(SerializationStream *stream, const SubrecordDefinition &subrecord, const TESStruct &context, const SubrecordOrigin *origin, ExpressionEvaluator &evaluator) const;
+		bool keepSourceSubrecord(const SubrecordDefinition &subrecord, const TESStruct &context, const SubrecordOrigin &origin, ExpressionEvaluator &evaluator) const;
+		static bool subrecordPresent(const SubrecordDefinition &subrecord, const TESStruct &context);
+		static bool encodeSubrecordData(const SubrecordDefinition &subrecord, const TESStruct &context, ExpressionEvaluator &evaluator, std::vector<unsigned char> &data);
+		static size_t encodeFraming(SerializationStream *stream, const DecodingProgram &program, TESFieldSlot nameSlot, TESFieldSlot sizeSlot, TESFieldSlot dataSlot, uint32_t fourcc, size_t dataSize, const TESStruct *fields, ExpressionEvaluator &evaluator);
+		static size_t encodeFields(SerializationStream *stream, const DecodingProgram &program, const TESStruct &st, ExpressionEvaluator &evaluator);
+		static size_t encodeFieldValue(SerializationStream *stream, const DecodingInstruction *instruction, const TESValue &value, const TESStruct &context, ExpressionEvaluator &evaluator);
+		template<bool Checked = true>
+		void parseFields(InputSerializationStream &stream, const DecodingProgram &program, TESStruct &record, const std::vector<bool> *decodedFields, bool referenceSource, std::pmr::memory_resource *arena, ExpressionEvaluator &evaluator) const;
+		template<bool Checked>
+		TESValue parseFieldValue(InputSerializationStream &stream, const DecodingInstruction *instruction, const TESStruct &context, bool referenceSource, std::pmr::memory_resource *arena, ExpressionEvaluator &evaluator) const;
+		template<bool Checked>
+		void skipFieldValue(InputSerializationStream &stream, const DecodingInstruction *instruction, const TESStruct &context, ExpressionEvaluator &evaluator) const;
+		template<typename T, bool Checked>
+		static TESValue parseTypedArray(InputSerializationStream &stream, size_t count, std::pmr::memory_resource *arena);
+		ExpressionInteger evaluateLength(InputSerializationStream &stream, const DecodingInstruction *instruction, const TESStruct &context, ExpressionEvaluator &evaluator) const;
 
-		std::unique_ptr<TESStruct> m_header;
-		std::vector<std::pair<std::string, std::unique_ptr<TESStruct>>> m_records;
+		std::unique_ptr<FileMapping> m_mapping;
+		std::vector<std::unique_ptr<std::pmr::monotonic_buffer_resource>> m_arenas; // one per decoding thread; the first one is also used by lazy decoding
+		const TESStruct *m_header;
+		mutable std::vector<std::pair<std::string, const TESStruct *>> m_records;
+		std::vector<RecordIndexEntry> m_index;
+		std::vector<SkippedRecord> m_skippedRecords; // in file order
+		RecordIndexEntry m_headerEntry;
+		std::vector<bool> m_modified; // by record index
+		bool m_headerModified;
+		std::unordered_map<const RecordDefinition *, RecordProjection> m_projections;
 		const tesparse::TESFileFormatDescription *m_description;
+		const DecodingProgram *m_recordProgram;
+		const DecodingProgram *m_subrecordProgram;
+		const TESStructLayout *m_recordLayout;
+		const TESStructLayout *m_subrecordLayout;
+		TESFieldSlot m_recordNameSlot;
+		TESFieldSlot m_recordSizeSlot;
+		TESFieldSlot m_recordDataSlot;
+		TESFieldSlot m_subrecordNameSlot;
+		TESFieldSlot m_subrecordSizeSlot;
+		TESFieldSlot m_subrecordDataSlot;
+		std::vector<TESFieldSlot> m_recordHeaderSlots; // Record fields carried over into the record contents
+		bool m_zeroCopy;
+		mutable std::mutex m_layoutDriftMutex;
+		mutable std::vector<TESLayoutDrift> m_layoutDrift;
 	};
 }
 
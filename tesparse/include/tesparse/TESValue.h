@@ -1,36 +1,159 @@
 #ifndef TESPARSE_TES_VALUE_H
 #define TESPARSE_TES_VALUE_H
 
+#include <stdint.h>
+
 #include <variant>
 #include <unordered_map>
 #include <vector>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <memory_resource>
 
 namespace tesparse {
 	struct TESStruct;
 	struct TESArray;
 
+	/*
+	 * Non-owning reference to a byte range of the source file. Only produced
+	 * when the data is loaded with TESLoadOptions::zeroCopy, and only valid
+	 * while the TESGameData that produced it is alive.
+	 */
+	struct TESByteArrayView {
+		const unsigned char *data;
+		size_t size;
+	};
+
+	/*
+	 * Array of a primitive element type, stored contiguously. Arrays whose
+	 * elements are integers or floats are decoded into these instead of
+	 * TESArray.
+	 */
+	template<typename T>
+	struct TESTypedArray {
+		std::pmr::vector<T> values;
+
+		TESTypedArray() = default;
+		explicit TESTypedArray(std::pmr::memory_resource *resource) : values(resource) {
+
+		}
+	};
+
+	using TESInt8Array = TESTypedArray<int8_t>;
+	using TESUInt8Array = TESTypedArray<uint8_t>;
+	using TESUInt16Array = TESTypedArray<uint16_t>;
+	using TESInt32Array = TESTypedArray<int32_t>;
+	using TESUInt32Array = TESTypedArray<uint32_t>;
+	using TESFloatArray = TESTypedArray<float>;
+
 	using TESUInt = uint32_t;
 	using TESInt = int32_t;
-	using TESValue = std::variant<std::monostate, TESStruct, TESArray, TESUInt, TESInt, float, std::vector<unsigned char>, std::string>;
+	using TESValue = std::variant<std::monostate, TESStruct, TESArray, TESUInt, TESInt, float, std::pmr::vector<unsigned char>, std::pmr::string, TESByteArrayView, std::string_view,
+		TESInt8Array, TESUInt8Array, TESUInt16Array, TESInt32Array, TESUInt32Array, TESFloatArray>;
+
+	/*
+	 * Index of a field in a TESStructLayout. Resolving a field name to a slot
+	 * once and then accessing TESStruct by slot avoids hashing the name for
+	 * every access.
+	 */
+	using TESFieldSlot = size_t;
+
+	/*
+	 * Schema of a TESStruct: names of all fields that a struct of this type
+	 * may have, in description order. Layouts are owned by
+	 * TESFileFormatDescription and shared by all structs of the same type.
+	 */
+	class TESStructLayout {
+	public:
+		TESStructLayout();
+		~TESStructLayout();
+
+		TESStructLayout(const TESStructLayout &other) = delete;
+		TESStructLayout &operator =(const TESStructLayout &other) = delete;
+
+		TESStructLayout(TESStructLayout &&other);
+		TESStructLayout &operator =(TESStructLayout &&other);
+
+		TESFieldSlot addField(const std::string &name);
+
+		const TESFieldSlot *tryGetSlot(const std::string &name) const;
+		TESFieldSlot slot(const std::string &name) const;
+
+		inline size_t size() const { return m_fieldNames.size(); }
+		inline const std::string &fieldName(TESFieldSlot slot) const { return m_fieldNames[slot]; }
+
+	private:
+		std::vector<std::string> m_fieldNames;
+		std::unordered_map<std::string, TESFieldSlot> m_slots;
+	};
+
+	/*
+	 * TESArray and TESStruct allocate from a memory resource, which for data
+	 * produced by TESGameData is an arena owned by the TESGameData.
+	 */
+	struct TESArray {
+		std::pmr::vector<TESValue> values;
 
+		TESArray();
+		explicit TESArray(std::pmr::memory_resource *resource);
+		~TESArray();
+
+		TESArray(const TESArray &other);
+		TESArray &operator =(const TESArray &other);
+
+		TESArray(TESArray &&other) noexcept;
+		TESArray &operator =(TESArray &&other);
+	};
+
+	/*
+	 * Fields are stored by slot of the struct's layout. Fields that were not
+	 * present in the data hold std::monostate.
+	 */
 	struct TESStruct {
-		std::unordered_map<std::string, TESValue> fields;
+		const TESStructLayout *layout;
+		std::pmr::vector<TESValue> fields;
+
+		TESStruct();
+		explicit TESStruct(const TESStructLayout *layout, std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+		~TESStruct();
+
+		TESStruct(const TESStruct &other);
+		TESStruct &operator =(const TESStruct &other);
+
+		TESStruct(TESStruct &&other) noexcept;
+		TESStruct &operator =(TESStruct &&other);
+
+		inline bool hasField(TESFieldSlot slot) const {
+			return slot < fields.size() && !std::holds_alternative<std::monostate>(fields[slot]);
+		}
+
+		inline const std::string &fieldName(TESFieldSlot slot) const {
+			return layout->fieldName(slot);
+		}
+
+		const TESValue *tryGetField(const std::string &name) const;
+
+		template<typename T>
+		const T &value(TESFieldSlot slot) const {
+			if (!hasField(slot)) {
+				throw std::logic_error("Required field is not present: " + (slot < fields.size() ? fieldName(slot) : std::to_string(slot)));
+			}
+
+			return std::get<T>(fields[slot]);
+		}
 
 		template<typename T>
 		const T &value(const std::string &name) const {
-			auto it = fields.find(name);
-			if (it == fields.end()) {
+			auto field = tryGetField(name);
+			if (!field) {
 				throw std::logic_error("Required field is not present: " + name);
 			}
 
-			return std::get<T>(it->second);
+			return std::get<T>(*field);
 		}
 	};
 
-	struct TESArray {
-		std::vector<TESValue> values;
-	};
-
 }
 
 #endif
@@ -0,0 +1,91 @@
+#ifndef TESPARSE_XML_PULL_PARSER_H
+#define TESPARSE_XML_PULL_PARSER_H
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tesparse {
+	enum class XmlNodeType {
+		None, // end of the document
+		Element,
+		EndElement,
+		Text
+	};
+
+	/*
+	 * Non-validating pull parser for UTF-8 XML documents, covering what
+	 * description files use: elements, attributes, character and predefined
+	 * entity references, comments, processing instructions and CDATA
+	 * sections. The document type declaration is skipped, so default
+	 * attribute values declared in the DTD are not applied.
+	 *
+	 * Names and values are views into the document or into storage owned by
+	 * the parser, and stay valid until the next call to read().
+	 */
+	class XmlPullParser {
+	public:
+		XmlPullParser(const char *data, size_t size);
+		~XmlPullParser();
+
+		XmlPullParser(const XmlPullParser &other) = delete;
+		XmlPullParser &operator =(const XmlPullParser &other) = delete;
+
+		/*
+		 * Advances to the next element start, element end or text that isn't
+		 * all whitespace; everything else is skipped. An empty element
+		 * (<Name/>) is reported as an element start only.
+		 */
+		XmlNodeType read();
+
+		// Element and EndElement only
+		inline const std::string_view &name() const { return m_name; }
+
+		// Element only
+		inline bool isEmptyElement() const { return m_emptyElement; }
+		bool tryGetAttribute(const std::string_view &name, std::string_view &value) const;
+
+		// Text only
+		inline const std::string_view &text() const { return m_text; }
+
+		static const char *nodeTypeName(XmlNodeType type);
+
+	private:
+		struct Attribute {
+			std::string_view name;
+			std::string_view value;
+		};
+
+		[[noreturn]] void error(const std::string &message, const char *position) const;
+
+		inline bool startsWith(const std::string_view &literal) const {
+			return static_cast<size_t>(m_end - m_ptr) >= literal.size() && std::string_view(m_ptr, literal.size()) == literal;
+		}
+
+		void skipSpace();
+		void skipPast(const std::string_view &terminator, const char *construct);
+		void skipDoctype();
+		void parseProcessingInstruction();
+		std::string_view parseName();
+		void parseStartTag();
+		void parseEndTag();
+		bool parseText();
+		std::string_view decode(const char *begin, const char *end, bool attribute);
+		void appendReference(const char *&ptr, const char *end, std::string &output);
+
+		const char *m_begin;
+		const char *m_end;
+		const char *m_ptr;
+
+		std::string_view m_name;
+		std::string_view m_text;
+		bool m_emptyElement;
+		bool m_rootClosed;
+		std::vector<Attribute> m_attributes;
+		std::vector<std::string_view> m_openElements;
+		std::deque<std::string> m_decoded; // values that contained references
+	};
+}
+
+#endif
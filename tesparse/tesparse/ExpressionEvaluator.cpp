@@ -1,131 +1,225 @@
 #include <tesparse/ExpressionEvaluator.h>
-#include <tesparse/TESValue.h>
 
+#include <algorithm>
 #include <stdexcept>
+#include <limits>
+#include <type_traits>
 
 namespace tesparse {
 	ExpressionEvaluator::ExpressionEvaluator() = default;
 
 	ExpressionEvaluator::~ExpressionEvaluator() = default;
 
-	ExpressionInteger ExpressionEvaluator::evaluate(const Expression &expression, const TESStruct &context) {
-		for (const auto &op : expression) {
-			std::visit([this, &context](const auto &arg) {
-				execute(arg, context);
-			}, op);
-		}
+	/*
+	 * Tracks which stack entries are constants while emitting steps, and
+	 * replaces an operator whose operands are all constants with its result.
+	 * Operations that would throw in apply(), such as division by a constant
+	 * zero or an out-of-range shift, are left to run time.
+	 */
+	CompiledExpression ExpressionEvaluator::compile(const Expression &expression, const TESStructLayout &layout) {
+		CompiledExpression compiled;
+		std::vector<bool> constantStack;
+
+		auto pushStep = [&](const ExpressionStep &step) {
+			if (constantStack.size() == MaxStackDepth)
+				throw std::runtime_error("expression is too deep");
+
+			compiled.steps.push_back(step);
+			constantStack.push_back(step.kind == ExpressionStepKind::Constant);
+		};
+
+		for (const auto &token : expression) {
+			if (auto val = std::get_if<ExpressionInteger>(&token)) {
+				pushStep(ExpressionStep{ ExpressionStepKind::Constant, ExpressionOperator::Add, *val, 0 });
+			}
+			else if (auto variable = std::get_if<std::string>(&token)) {
+				auto slot = layout.tryGetSlot(*variable);
+				if (!slot)
+					throw std::runtime_error("undefined variable: " + *variable);
 
-		if (m_stack.size() != 1) {
-			throw std::runtime_error("unexpected stack depth at the end of expression");
-		}
+				pushStep(ExpressionStep{ ExpressionStepKind::Variable, ExpressionOperator::Add, 0, *slot });
+			}
+			else {
+				auto op = std::get<ExpressionOperator>(token);
+
+				size_t operands;
+				switch (op) {
+				case ExpressionOperator::Not:
+					operands = 1;
+					break;
+
+				case ExpressionOperator::Add:
+				case ExpressionOperator::Subtract:
+				case ExpressionOperator::Multiply:
+				case ExpressionOperator::Divide:
+				case ExpressionOperator::Modulo:
+				case ExpressionOperator::And:
+				case ExpressionOperator::Or:
+				case ExpressionOperator::Xor:
+				case ExpressionOperator::LeftShift:
+				case ExpressionOperator::RightShift:
+					operands = 2;
+					break;
+
+				default:
+					throw std::logic_error("unsupported operator");
+				}
 
-		return popStack();
-	}
+				if (constantStack.size() < operands)
+					throw std::runtime_error("stack underflow");
 
-	void ExpressionEvaluator::execute(ExpressionOperator op, const TESStruct &context) {
-		if (op == ExpressionOperator::Not) {
-			auto val = popStack();
+				auto constantOperands = std::all_of(constantStack.end() - operands, constantStack.end(), [](bool constant) { return constant; });
 
-			m_stack.push_back(~val);
-		}
-		else {
-			auto left = popStack();
-			auto right = popStack();
+				if (constantOperands && operands == 2 && traps(op, compiled.steps.back().constant, compiled.steps[compiled.steps.size() - 2].constant)) {
+					constantOperands = false;
+				}
 
-			ExpressionInteger result;
+				if (constantOperands) {
+					ExpressionInteger result;
 
-			switch (op) {
-			case ExpressionOperator::Add:
-				result = left + right;
-				break;
+					// The left operand is the one on top of the stack
+					auto left = compiled.steps.back().constant;
+					if (operands == 1) {
+						result = ~left;
+					}
+					else {
+						result = apply(op, left, compiled.steps[compiled.steps.size() - 2].constant);
+					}
 
-			case ExpressionOperator::Subtract:
-				result = left - right;
-				break;
+					compiled.steps.resize(compiled.steps.size() - operands);
+					constantStack.resize(constantStack.size() - operands);
 
-			case ExpressionOperator::Multiply:
-				result = left * right;
-				break;
+					pushStep(ExpressionStep{ ExpressionStepKind::Constant, ExpressionOperator::Add, result, 0 });
+				}
+				else {
+					constantStack.resize(constantStack.size() - operands);
+					pushStep(ExpressionStep{ ExpressionStepKind::Operator, op, 0, 0 });
+				}
+			}
+		}
 
-			case ExpressionOperator::Divide:
-				result = left / right;
-				break;
+		if (constantStack.size() != 1) {
+			throw std::runtime_error("unexpected stack depth at the end of expression");
+		}
 
-			case ExpressionOperator::Modulo:
-				result = left % right;
-				break;
+		return compiled;
+	}
 
-			case ExpressionOperator::And:
-				result = left & right;
-				break;
+	ExpressionInteger ExpressionEvaluator::evaluate(const CompiledExpression &expression, const TESStruct &context) {
+		auto stackTop = m_stack;
 
-			case ExpressionOperator::Or:
-				result = left | right;
+		for (const auto &step : expression.steps) {
+			switch (step.kind) {
+			case ExpressionStepKind::Constant:
+				*stackTop++ = step.constant;
 				break;
 
-			case ExpressionOperator::Xor:
-				result = left ^ right;
+			case ExpressionStepKind::Variable:
+				*stackTop++ = variableValue(context, step.slot);
 				break;
 
-			case ExpressionOperator::LeftShift:
-				result = left << right;
+			case ExpressionStepKind::Operator:
+				if (step.op == ExpressionOperator::Not) {
+					stackTop[-1] = ~stackTop[-1];
+				}
+				else {
+					stackTop--;
+					stackTop[-1] = apply(step.op, stackTop[0], stackTop[-1]);
+				}
 				break;
+			}
+		}
 
-			case ExpressionOperator::RightShift:
-				result = left >> right;
-				break;
+		return m_stack[0];
+	}
 
-			default:
-				throw std::logic_error("unsupported operator");
-			}
+	bool ExpressionEvaluator::traps(ExpressionOperator op, ExpressionInteger left, ExpressionInteger right) {
+		switch (op) {
+		case ExpressionOperator::Divide:
+		case ExpressionOperator::Modulo:
+			return right == 0 || (left == std::numeric_limits<ExpressionInteger>::min() && right == -1);
+
+		case ExpressionOperator::LeftShift:
+		case ExpressionOperator::RightShift:
+			return right < 0 || right >= std::numeric_limits<std::make_unsigned_t<ExpressionInteger>>::digits;
 
-			m_stack.push_back(result);
+		default:
+			return false;
 		}
 	}
 
-	ExpressionInteger ExpressionEvaluator::popStack() {
-		if (m_stack.empty())
-			throw std::runtime_error("stack underflow");
+	ExpressionInteger ExpressionEvaluator::apply(ExpressionOperator op, ExpressionInteger left, ExpressionInteger right) {
+		switch (op) {
+		case ExpressionOperator::Add:
+			return left + right;
 
-		auto val = m_stack.back();
-		m_stack.pop_back();
+		case ExpressionOperator::Subtract:
+			return left - right;
 
-		return val;
-	}
+		case ExpressionOperator::Multiply:
+			return left * right;
 
-	void ExpressionEvaluator::execute(ExpressionInteger val, const TESStruct &context) {
-		(void)context;
+		case ExpressionOperator::Divide:
+		case ExpressionOperator::Modulo:
+			// Operands come from the data files, so both cases that trap have to be caught
+			if (right == 0)
+				throw std::runtime_error("division by zero in expression");
 
-		m_stack.push_back(val);
-	}
+			if (left == std::numeric_limits<ExpressionInteger>::min() && right == -1)
+				throw std::runtime_error("division overflow in expression");
+
+			return op == ExpressionOperator::Divide ? left / right : left % right;
+
+		case ExpressionOperator::And:
+			return left & right;
+
+		case ExpressionOperator::Or:
+			return left | right;
+
+		case ExpressionOperator::Xor:
+			return left ^ right;
+
+		case ExpressionOperator::LeftShift:
+		case ExpressionOperator::RightShift:
+			if (right < 0 || right >= std::numeric_limits<std::make_unsigned_t<ExpressionInteger>>::digits)
+				throw std::runtime_error("shift count out of range in expression");
 
-	void ExpressionEvaluator::execute(const std::string &variable, const TESStruct &context) {
-		auto it = context.fields.find(variable);
-		if (it == context.fields.end()) {
-			throw std::runtime_error("variable is not in context: " + variable);
+			// Left shifts are done unsigned, as shifting a negative value left is undefined
+			if (op == ExpressionOperator::LeftShift)
+				return static_cast<ExpressionInteger>(static_cast<std::make_unsigned_t<ExpressionInteger>>(left) << right);
+
+			return left >> right;
+
+		default:
+			throw std::logic_error("unsupported operator");
 		}
+	}
 
-		auto uval = std::get_if<TESUInt>(&it->second);
+	ExpressionInteger ExpressionEvaluator::variableValue(const TESStruct &context, TESFieldSlot slot) {
+		const auto &value = context.fields[slot];
+
+		auto uval = std::get_if<TESUInt>(&value);
 		if (uval) {
-			if (*uval > std::numeric_limits<ExpressionInteger>::max()) {
+			if (*uval > static_cast<TESUInt>(std::numeric_limits<ExpressionInteger>::max())) {
 				throw std::runtime_error("variable value is not representable in expression");
 			}
 
-			m_stack.push_back(static_cast<ExpressionInteger>(*uval));
+			return static_cast<ExpressionInteger>(*uval);
 		}
-		else {
-			auto ival = std::get_if<TESInt>(&it->second);
-
-			if (ival) {
-				if (*ival > std::numeric_limits<ExpressionInteger>::max() || *ival < std::numeric_limits<ExpressionInteger>::min()) {
-					throw std::runtime_error("variable value is not representable in expression");
-				}
 
-				m_stack.push_back(static_cast<ExpressionInteger>(*ival));
-			}
-			else {
+		auto ival = std::get_if<TESInt>(&value);
+		if (ival) {
+			if (*ival > std::numeric_limits<ExpressionInteger>::max() || *ival < std::numeric_limits<ExpressionInteger>::min()) {
 				throw std::runtime_error("variable value is not representable in expression");
 			}
+
+			return static_cast<ExpressionInteger>(*ival);
 		}
+
+		if (std::holds_alternative<std::monostate>(value)) {
+			throw std::runtime_error("variable is not in context: " + std::string(context.fieldName(slot)));
+		}
+
+		throw std::runtime_error("variable value is not representable in expression");
 	}
 }
@@ -1,62 +1,93 @@
 #include <tesparse/ExpressionParser.h>
 
-#include <regex>
-#include <unordered_map>
+#include <stdexcept>
+#include <string>
 
 namespace tesparse {
 	ExpressionParser::ExpressionParser() = default;
 
 	ExpressionParser::~ExpressionParser() = default;
 
+	/*
+	 * Hand-written scanner; the accepted tokens are, in order of precedence:
+	 *  - whitespace: [ \t\n\v\f\r]+
+	 *  - variable names: [A-Za-z_][A-Za-z0-9_]*
+	 *  - numbers: 0x[0-9A-Fa-f]+, 0[0-7]? or [0-9]+, converted as by stoi with
+	 *    base 0
+	 *  - operators: one of +-*%/&|^~() or << or >>
+	 */
 	void ExpressionParser::parse(const std::string_view &string) {
-		static const std::regex spaceRegex("^\\s+");
-		static const std::regex variableNameRegex("^[A-Za-z_][A-Za-z0-9_]*");
-		static const std::regex numberRegex("^(?:0x[0-9A-Fa-f]+|0[0-7]?|[0-9]+)");
-		static const std::regex operatorRegex("^(?:[+\\-*/%&|^~()]|<<|>>)");
-		static std::unordered_map<std::string_view, ExpressionOperator> operatorMap{
-			{ "+", ExpressionOperator::Add },
-			{ "-", ExpressionOperator::Subtract },
-			{ "*", ExpressionOperator::Multiply },
-			{ "/", ExpressionOperator::Divide },
-			{ "%", ExpressionOperator::Modulo },
-			{ "&", ExpressionOperator::And },
-			{ "|", ExpressionOperator::Or },
-			{ "^", ExpressionOperator::Not },
-			{ "(", ExpressionOperator::LeftParenthesis },
-			{ ")", ExpressionOperator::RightParenthesis },
-			{ "<<", ExpressionOperator::LeftShift },
-			{ ">>", ExpressionOperator::RightShift }
-		};
-
-		auto pos = string.cbegin();
-
-		while (pos != string.end()) {
-			auto sliceStart = pos;
-
-			std::string_view slice(&*pos, string.end() - pos);
+		auto pos = string.begin();
+		auto end = string.end();
 
-			std::match_results<std::string_view::const_iterator> results;
+		while (pos != end) {
+			auto sliceStart = pos;
+			auto ch = *pos;
 
-			if (std::regex_search(slice.begin(), slice.end(), results, spaceRegex)) {
-				pos += results[0].length();
+			if (isSpace(ch)) {
+				do {
+					pos++;
+				} while (pos != end && isSpace(*pos));
 			}
-			else if (std::regex_search(slice.begin(), slice.end(), results, variableNameRegex)) {
-				pos += results[0].length();
+			else if (isIdentifierStart(ch)) {
+				do {
+					pos++;
+				} while (pos != end && (isIdentifierStart(*pos) || isDigit(*pos)));
 
 				m_expression.emplace_back(std::string(sliceStart, pos));
-			} else if(std::regex_search(slice.begin(), slice.end(), results, numberRegex)) {
-				pos += results[0].length();
+			}
+			else if (isDigit(ch)) {
+				pos++;
+
+				if (ch == '0') {
+					if (pos + 1 < end && *pos == 'x' && isHexDigit(pos[1])) {
+						pos += 2;
+						while (pos != end && isHexDigit(*pos))
+							pos++;
+					}
+					else if (pos != end && *pos >= '0' && *pos <= '7') {
+						pos++;
+					}
+				}
+				else {
+					while (pos != end && isDigit(*pos))
+						pos++;
+				}
 
 				m_expression.emplace_back(std::stoi(std::string(sliceStart, pos), nullptr, 0));
 			}
-			else if (std::regex_search(slice.begin(), slice.end(), results, operatorRegex)) {
-				pos += results[0].length();
-
-				auto it = operatorMap.find(std::string_view(&*sliceStart, (pos - sliceStart)));
-				if (it == operatorMap.end())
+			else {
+				ExpressionOperator op;
+
+				switch (ch) {
+				case '+': op = ExpressionOperator::Add; break;
+				case '-': op = ExpressionOperator::Subtract; break;
+				case '*': op = ExpressionOperator::Multiply; break;
+				case '/': op = ExpressionOperator::Divide; break;
+				case '%': op = ExpressionOperator::Modulo; break;
+				case '&': op = ExpressionOperator::And; break;
+				case '|': op = ExpressionOperator::Or; break;
+				case '^': op = ExpressionOperator::Not; break;
+				case '(': op = ExpressionOperator::LeftParenthesis; break;
+				case ')': op = ExpressionOperator::RightParenthesis; break;
+
+				case '~':
 					throw std::logic_error("operator is not in map");
 
-				auto op = it->second;
+				case '<':
+				case '>':
+					if (pos + 1 < end && pos[1] == ch) {
+						op = ch == '<' ? ExpressionOperator::LeftShift : ExpressionOperator::RightShift;
+						pos++;
+						break;
+					}
+					/* fall through */
+
+				default:
+					throw std::runtime_error("syntax error: " + std::string(sliceStart, end));
+				}
+
+				pos++;
 
 				if (op == ExpressionOperator::LeftParenthesis) {
 					m_operatorStack.push_back(op);
@@ -84,9 +115,6 @@ namespace tesparse {
 
 					m_operatorStack.push_back(op);
 				}
-
-			} else {
-				throw std::runtime_error("syntax error: " + std::string(slice));
 			}
 		}
 
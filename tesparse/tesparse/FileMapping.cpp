@@ -1,18 +1,24 @@
 #include <tesparse/FileMapping.h>
 #include <tesparse/StringConversions.h>
 
+#include <stdexcept>
+
 #include <Windows.h>
 #include <comdef.h>
 
 namespace tesparse {
-	FileMapping::FileMapping(const std::string_view &filename) {
+	FileMapping::FileMapping(const std::string_view &filename, const FileMappingOptions &options) : m_size(0), m_writable(options.writable) {
+		/*
+		 * Only the sequential hint has a direct equivalent here; the rest
+		 * of the access pattern hints are POSIX-specific and are ignored.
+		 */
 		auto rawFileHandle = CreateFile(
 			utf8ToWide(filename).c_str(),
-			GENERIC_READ,
+			options.writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
 			FILE_SHARE_READ,
 			nullptr,
 			OPEN_EXISTING,
-			0,
+			options.sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0,
 			nullptr
 		);
 		if (rawFileHandle == INVALID_HANDLE_VALUE)
@@ -22,7 +28,7 @@ namespace tesparse {
 		auto rawSectionHandle = CreateFileMapping(
 			m_fileHandle.get(),
 			nullptr,
-			PAGE_READONLY,
+			options.writable ? PAGE_READWRITE : PAGE_READONLY,
 			0, 0,
 			nullptr
 		);
@@ -31,7 +37,7 @@ namespace tesparse {
 
 		m_sectionHandle.reset(rawSectionHandle);
 
-		auto rawMapping = MapViewOfFile(m_sectionHandle.get(), FILE_MAP_READ, 0, 0, 0);
+		auto rawMapping = MapViewOfFile(m_sectionHandle.get(), options.writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
 		if(!rawMapping)
 			_com_raise_error(HRESULT_FROM_WIN32(GetLastError()));
 
@@ -46,6 +52,24 @@ namespace tesparse {
 
 	FileMapping::~FileMapping() = default;
 
+	void *FileMapping::writableBase() {
+		if (!m_writable)
+			throw std::logic_error("the file is not mapped for writing");
+
+		return m_mapping.get();
+	}
+
+	void FileMapping::flush() {
+		if (!m_writable || !m_mapping)
+			return;
+
+		if (!FlushViewOfFile(m_mapping.get(), 0))
+			_com_raise_error(HRESULT_FROM_WIN32(GetLastError()));
+
+		if (!FlushFileBuffers(m_fileHandle.get()))
+			_com_raise_error(HRESULT_FROM_WIN32(GetLastError()));
+	}
+
 	void FileMapping::MappingDeleter::operator()(void *base) const {
 		UnmapViewOfFile(base);
 	}
@@ -0,0 +1,83 @@
+#include <tesparse/FileMapping.h>
+
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace tesparse {
+	FileMapping::FileMapping(const std::string_view &filename, const FileMappingOptions &options) : m_mapping(nullptr, MappingDeleter{ 0 }), m_size(0), m_writable(options.writable) {
+		auto rawFileDescriptor = open(std::string(filename).c_str(), (options.writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+		if (rawFileDescriptor < 0)
+			throw std::system_error(errno, std::generic_category(), "open");
+		m_fileDescriptor.reset(rawFileDescriptor);
+
+		struct stat status;
+		if (fstat(m_fileDescriptor.get(), &status) < 0)
+			throw std::system_error(errno, std::generic_category(), "fstat");
+
+		m_size = static_cast<size_t>(status.st_size);
+
+		/*
+		 * mmap rejects zero-length mappings, so an empty file is represented
+		 * by a null base.
+		 */
+		if (m_size == 0)
+			return;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+		if (options.sequential)
+			posix_fadvise(m_fileDescriptor.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+		int flags = options.writable ? MAP_SHARED : MAP_PRIVATE;
+#ifdef MAP_POPULATE
+		if (options.populate)
+			flags |= MAP_POPULATE;
+#endif
+
+		auto rawMapping = mmap(nullptr, m_size, options.writable ? PROT_READ | PROT_WRITE : PROT_READ, flags, m_fileDescriptor.get(), 0);
+		if (rawMapping == MAP_FAILED)
+			throw std::system_error(errno, std::generic_category(), "mmap");
+
+		m_mapping = std::unique_ptr<void, MappingDeleter>(rawMapping, MappingDeleter{ m_size });
+
+		/*
+		 * madvise failures are not fatal: the hints only affect performance,
+		 * and e.g. MADV_HUGEPAGE is refused on kernels without THP support
+		 * for file-backed memory.
+		 */
+
+		if (options.sequential)
+			madvise(rawMapping, m_size, MADV_SEQUENTIAL);
+
+		if (options.willNeed)
+			madvise(rawMapping, m_size, MADV_WILLNEED);
+
+#ifdef MADV_HUGEPAGE
+		if (options.hugePages)
+			madvise(rawMapping, m_size, MADV_HUGEPAGE);
+#endif
+	}
+
+	FileMapping::~FileMapping() = default;
+
+	void *FileMapping::writableBase() {
+		if (!m_writable)
+			throw std::logic_error("the file is not mapped for writing");
+
+		return m_mapping.get();
+	}
+
+	void FileMapping::flush() {
+		if (m_writable && m_mapping && msync(m_mapping.get(), m_size, MS_SYNC) < 0)
+			throw std::system_error(errno, std::generic_category(), "msync");
+	}
+
+	void FileMapping::MappingDeleter::operator()(void *base) const {
+		munmap(base, size);
+	}
+}
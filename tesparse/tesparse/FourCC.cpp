@@ -1,5 +1,6 @@
 #include <tesparse/FourCC.h>
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace tesparse {
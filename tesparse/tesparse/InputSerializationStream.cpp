@@ -17,15 +17,7 @@ namespace tesparse {
 	}
 
 	const unsigned char *InputSerializationStream::getRegionForRead(size_t size) {
-		if (static_cast<intptr_t>(size) > m_end - m_ptr) {
-			throw std::logic_error("read is out of bounds");
-		}
-
-		auto ptr = m_ptr;
-
-		m_ptr += size;
-
-		return ptr;
+		return readRegion(size);
 	}
 
 	size_t InputSerializationStream::getCurrentPosition() const {
@@ -40,7 +32,11 @@ namespace tesparse {
 	}
 
 	size_t InputSerializationStream::remainingSize() const {
-		return static_cast<size_t>(m_end - m_ptr);
+		return remaining();
+	}
+
+	void InputSerializationStream::throwOutOfBounds() {
+		throw std::logic_error("read is out of bounds");
 	}
 
 }
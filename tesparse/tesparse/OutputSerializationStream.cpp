@@ -1,13 +1,16 @@
 #include <tesparse/OutputSerializationStream.h>
 
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 namespace tesparse {
-	OutputSerializationStream::OutputSerializationStream() : m_targetStream(nullptr), m_position(0), m_offset(0) {
+	OutputSerializationStream::OutputSerializationStream() : m_targetStream(nullptr), m_position(0), m_offset(0), m_blockFree(nullptr), m_blockRemaining(0), m_size(0) {
 
 	}
 
-	OutputSerializationStream::OutputSerializationStream(SerializationStream *otherStream) : m_targetStream(otherStream), m_position(0), m_offset(m_targetStream->getCurrentPosition()) {
+	OutputSerializationStream::OutputSerializationStream(SerializationStream *otherStream) : m_targetStream(otherStream), m_position(0), m_offset(m_targetStream->getCurrentPosition()),
+		m_blockFree(nullptr), m_blockRemaining(0), m_size(0) {
 
 	}
 
@@ -19,12 +22,35 @@ namespace tesparse {
 		if (m_targetStream) {
 			ptr = m_targetStream->getRegionForWrite(size);
 		}
+		else if (m_position >= m_size) {
+			// Skipped over bytes read as zeroes
+			if (m_position > m_size) {
+				auto gap = m_position - m_size;
+				memset(append(gap), 0, gap);
+			}
+
+			ptr = append(size);
+		}
 		else {
+			const auto &segment = findSegment(m_position);
+			if (segment.external)
+				throw std::logic_error("external data can't be overwritten");
+
+			auto offset = m_position - segment.position;
+			ptr = segment.data + offset;
+
+			/*
+			 * A write that starts before the end of the stream may only
+			 * extend it if the last segment can grow in place.
+			 */
+			if (offset + size > segment.size) {
+				auto extra = offset + size - segment.size;
 
-			if (m_data.size() < m_position + size)
-				m_data.resize(m_position + size);
+				if (&segment != &m_segments.back() || segment.data + segment.size != m_blockFree || extra > m_blockRemaining)
+					throw std::logic_error("write spans buffer segments");
 
-			ptr = m_data.data() + m_position;
+				append(extra);
+			}
 		}
 
 		m_position += size;
@@ -39,10 +65,21 @@ namespace tesparse {
 			ptr = m_targetStream->getRegionForRead(size);
 		}
 		else {
-			if (m_data.size() < m_position + size)
+			if (m_position > m_size || size > m_size - m_position)
 				throw std::logic_error("read is out of bounds");
 
-			ptr = m_data.data() + m_position;
+			if (size == 0) {
+				ptr = nullptr;
+			}
+			else {
+				const auto &segment = findSegment(m_position);
+
+				auto offset = m_position - segment.position;
+				if (offset + size > segment.size)
+					throw std::logic_error("read spans buffer segments");
+
+				ptr = segment.data + offset;
+			}
 		}
 
 		m_position += size;
@@ -59,14 +96,91 @@ namespace tesparse {
 		if(m_targetStream)
 			m_targetStream->setCurrentPosition(m_position + m_offset);
 	}
-	
+
 	size_t OutputSerializationStream::remainingSize() const {
 		if (m_targetStream) {
 			return m_targetStream->remainingSize();
 		}
 		else {
-			return m_data.size() - m_position;
+			return m_position < m_size ? m_size - m_position : 0;
+		}
+	}
+
+	std::vector<unsigned char> OutputSerializationStream::data() const {
+		std::vector<unsigned char> data;
+		data.reserve(m_size);
+
+		for (const auto &segment : m_segments) {
+			data.insert(data.end(), segment.data, segment.data + segment.size);
+		}
+
+		return data;
+	}
+
+	void OutputSerializationStream::reserve(size_t size) {
+		if (!m_targetStream && size > m_blockRemaining) {
+			allocateBlock(size);
 		}
 	}
 
+	void OutputSerializationStream::writeExternal(const unsigned char *data, size_t size) {
+		if (m_targetStream) {
+			m_targetStream->writeData(data, size);
+			m_position += size;
+			return;
+		}
+
+		if (m_position != m_size)
+			throw std::logic_error("external data can only be appended");
+
+		if (size != 0) {
+			m_segments.emplace_back(Segment{ const_cast<unsigned char *>(data), m_size, size, true });
+			m_size += size;
+			m_position += size;
+		}
+	}
+
+	const OutputSerializationStream::Segment &OutputSerializationStream::findSegment(size_t position) const {
+		auto it = std::upper_bound(m_segments.begin(), m_segments.end(), position, [](size_t position, const Segment &segment) {
+			return position < segment.position;
+		});
+
+		return *(it - 1);
+	}
+
+	/*
+	 * Appends 'size' bytes at the end of the stream, which is also where
+	 * m_position is, extending the last segment if it ends where the free
+	 * space of the block starts.
+	 */
+	unsigned char *OutputSerializationStream::append(size_t size) {
+		if (size > m_blockRemaining) {
+			allocateBlock(std::max(size, std::min(std::max(m_size, MinimumBlockSize), MaximumBlockSize)));
+		}
+
+		auto ptr = m_blockFree;
+
+		if (size != 0) {
+			if (!m_segments.empty() && !m_segments.back().external && m_segments.back().data + m_segments.back().size == ptr) {
+				m_segments.back().size += size;
+			}
+			else {
+				m_segments.emplace_back(Segment{ ptr, m_size, size, false });
+			}
+
+			m_blockFree += size;
+			m_blockRemaining -= size;
+			m_size += size;
+		}
+
+		return ptr;
+	}
+
+	void OutputSerializationStream::allocateBlock(size_t size) {
+		// Not value-initialized: every byte is written before it is read
+		auto &block = m_blocks.emplace_back(new unsigned char[size]);
+
+		m_blockFree = block.get();
+		m_blockRemaining = size;
+	}
 }
@@ -0,0 +1,66 @@
+#include <tesparse/OutputSerializationStream.h>
+#include <tesparse/PosixFileDescriptor.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+namespace tesparse {
+	void OutputSerializationStream::writeToFile(const std::string_view &filename) const {
+		if (m_targetStream)
+			throw std::logic_error("a stream writing into another stream can't be written to a file");
+
+		auto rawFileDescriptor = open(std::string(filename).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (rawFileDescriptor < 0)
+			throw std::system_error(errno, std::generic_category(), "open");
+
+		PosixFileDescriptor fileDescriptor(rawFileDescriptor);
+
+		std::vector<iovec> vectors;
+		vectors.reserve(m_segments.size());
+		for (const auto &segment : m_segments) {
+			vectors.emplace_back(iovec{ segment.data, segment.size });
+		}
+
+		/*
+		 * writev may write less than requested, in which case it is called
+		 * again for the rest, starting in the middle of a segment.
+		 */
+		auto vector = vectors.data();
+		auto end = vector + vectors.size();
+
+		while (vector != end) {
+			auto written = writev(fileDescriptor.get(), vector, static_cast<int>(std::min<size_t>(end - vector, IOV_MAX)));
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+
+				throw std::system_error(errno, std::generic_category(), "writev");
+			}
+
+			auto remaining = static_cast<size_t>(written);
+			while (vector != end && remaining >= vector->iov_len) {
+				remaining -= vector->iov_len;
+				vector++;
+			}
+
+			if (remaining != 0) {
+				vector->iov_base = static_cast<unsigned char *>(vector->iov_base) + remaining;
+				vector->iov_len -= remaining;
+			}
+		}
+
+		if (close(fileDescriptor.release()) < 0)
+			throw std::system_error(errno, std::generic_category(), "close");
+	}
+}
@@ -0,0 +1,46 @@
+#include <tesparse/OutputSerializationStream.h>
+#include <tesparse/StringConversions.h>
+#include <tesparse/WindowsHandle.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <Windows.h>
+#include <comdef.h>
+
+namespace tesparse {
+	/*
+	 * WriteFileGather only accepts page-sized buffers and unbuffered files,
+	 * so segments are written one by one instead.
+	 */
+	void OutputSerializationStream::writeToFile(const std::string_view &filename) const {
+		static const size_t maximumWriteSize = 1024 * 1024 * 1024;
+
+		if (m_targetStream)
+			throw std::logic_error("a stream writing into another stream can't be written to a file");
+
+		auto rawFileHandle = CreateFile(
+			utf8ToWide(filename).c_str(),
+			GENERIC_WRITE,
+			0,
+			nullptr,
+			CREATE_ALWAYS,
+			FILE_FLAG_SEQUENTIAL_SCAN,
+			nullptr
+		);
+		if (rawFileHandle == INVALID_HANDLE_VALUE)
+			_com_raise_error(HRESULT_FROM_WIN32(GetLastError()));
+
+		WindowsHandle fileHandle(rawFileHandle);
+
+		for (const auto &segment : m_segments) {
+			for (size_t offset = 0; offset < segment.size;) {
+				DWORD written;
+				if (!WriteFile(fileHandle.get(), segment.data + offset, static_cast<DWORD>(std::min(segment.size - offset, maximumWriteSize)), &written, nullptr))
+					_com_raise_error(HRESULT_FROM_WIN32(GetLastError()));
+
+				offset += written;
+			}
+		}
+	}
+}
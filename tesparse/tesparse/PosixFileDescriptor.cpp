@@ -0,0 +1,12 @@
+#include <tesparse/PosixFileDescriptor.h>
+
+#include <unistd.h>
+
+namespace tesparse {
+	void PosixFileDescriptor::reset(int fd) noexcept {
+		if (m_fd >= 0)
+			close(m_fd);
+
+		m_fd = fd;
+	}
+}
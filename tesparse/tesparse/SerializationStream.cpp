@@ -1,6 +1,7 @@
 #include <tesparse/SerializationStream.h>
 
 #include <algorithm>
+#include <cstring>
 
 namespace tesparse {
 	SerializationStream::SerializationStream() : m_swapEndian(false) {
@@ -1,9 +1,33 @@
 #include <tesparse/StringConversions.h>
 
+#ifdef _WIN32
 #include <windows.h>
 #include <comdef.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <sstream>
+
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || (defined(__i386__) && defined(__SSE2__))
+#define TESPARSE_SSE2 1
+#include <emmintrin.h>
+#endif
 
 namespace tesparse {
+	StringEncoding parseStringEncoding(const std::string_view &name) {
+		if (name == "UTF-8")
+			return StringEncoding::UTF8;
+		else if (name == "Windows-1252")
+			return StringEncoding::Windows1252;
+
+		std::stringstream error;
+		error << "Unsupported string encoding: " << name;
+		throw std::runtime_error(error.str());
+	}
+
+#ifdef _WIN32
 	std::wstring utf8ToWide(const std::string_view &string) {
 		if (string.empty())
 			return std::wstring();
@@ -35,4 +59,71 @@ namespace tesparse {
 
 		return output;
 	}
+#endif
+
+	/*
+	 * Checks 16 bytes at a time with SSE2 where available, 8 bytes at a time
+	 * otherwise.
+	 */
+	size_t asciiPrefixLength(const char *data, size_t size) {
+		size_t pos = 0;
+
+#ifdef TESPARSE_SSE2
+		for (; pos + 16 <= size; pos += 16) {
+			auto mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos)));
+			if (mask != 0)
+				break;
+		}
+#else
+		for (; pos + 8 <= size; pos += 8) {
+			uint64_t word;
+			memcpy(&word, data + pos, sizeof(word));
+			if ((word & 0x8080808080808080ULL) != 0)
+				break;
+		}
+#endif
+
+		while (pos < size && static_cast<unsigned char>(data[pos]) < 0x80) {
+			pos++;
+		}
+
+		return pos;
+	}
+
+	void windows1252ToUtf8(const std::string_view &string, std::string &output) {
+		static const uint16_t highControlRange[32]{
+			0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+			0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+		};
+
+		output.clear();
+		output.reserve(string.size() * 3);
+
+		auto data = string.data();
+		auto size = string.size();
+
+		size_t pos = 0;
+		while (pos < size) {
+			auto ascii = asciiPrefixLength(data + pos, size - pos);
+			output.append(data + pos, ascii);
+			pos += ascii;
+
+			while (pos < size && static_cast<unsigned char>(data[pos]) >= 0x80) {
+				auto byte = static_cast<unsigned char>(data[pos]);
+				unsigned int codepoint = byte < 0xA0 ? highControlRange[byte - 0x80] : byte;
+
+				if (codepoint < 0x800) {
+					output.push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+					output.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+				}
+				else {
+					output.push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+					output.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+					output.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+				}
+
+				pos++;
+			}
+		}
+	}
 }
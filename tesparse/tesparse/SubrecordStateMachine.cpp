@@ -0,0 +1,269 @@
+#include <tesparse/SubrecordStateMachine.h>
+#include <tesparse/TESFileFormatDescription.h>
+#include <tesparse/FourCC.h>
+
+#include <algorithm>
+#include <sstream>
+#include <unordered_set>
+
+namespace tesparse {
+	SubrecordStateMachine::SubrecordStateMachine() = default;
+
+	SubrecordStateMachine::~SubrecordStateMachine() = default;
+
+	void SubrecordStateMachine::build(const RecordDefinition &record) {
+		auto entryCount = record.entries.size();
+
+		m_states.clear();
+		m_arrayStateBase.assign(entryCount, 0);
+		m_transitions.clear();
+
+		for (size_t position = 0; position <= entryCount; position++) {
+			m_states.push_back(State{ position, -1 });
+		}
+
+		std::unordered_set<uint32_t> alphabet;
+
+		for (size_t position = 0; position < entryCount; position++) {
+			const auto &entry = record.entries[position];
+
+			if (auto subrecord = std::get_if<SubrecordDefinition>(&entry)) {
+				alphabet.insert(subrecord->fourcc);
+			}
+			else {
+				const auto &array = std::get<SubrecordArrayDefinition>(entry);
+
+				m_arrayStateBase[position] = static_cast<uint32_t>(m_states.size());
+				for (size_t arrayPosition = 0; arrayPosition <= array.subrecords.size(); arrayPosition++) {
+					m_states.push_back(State{ position, static_cast<ptrdiff_t>(arrayPosition) });
+				}
+
+				alphabet.insert(array.leader.begin(), array.leader.end());
+				for (const auto &subrecord : array.subrecords) {
+					alphabet.insert(subrecord.fourcc);
+				}
+			}
+		}
+
+		for (uint32_t state = 0, stateCount = static_cast<uint32_t>(m_states.size()); state < stateCount; state++) {
+			for (auto fourcc : alphabet) {
+				auto result = simulate(record, state, fourcc);
+				if (result.outcome == Outcome::Transition) {
+					m_transitions.emplace(transitionKey(state, fourcc), result.transition);
+				}
+			}
+		}
+	}
+
+	uint32_t SubrecordStateMachine::stateId(size_t position, ptrdiff_t arrayPosition) const {
+		if (arrayPosition < 0)
+			return static_cast<uint32_t>(position);
+
+		return m_arrayStateBase[position] + static_cast<uint32_t>(arrayPosition);
+	}
+
+	/*
+	 * The reference matching algorithm. Starting at the given state, it
+	 * looks for the first entry that can accept the subrecord, skipping over
+	 * optional entries, and restarts the current array member when a leader
+	 * subrecord of the array is seen after the member's required subrecords.
+	 */
+	SubrecordStateMachine::SimulationResult SubrecordStateMachine::simulate(const RecordDefinition &record, uint32_t state, uint32_t fourcc) const {
+		/*
+		 * Lookups can be retried after moving the position onto an array;
+		 * anything that takes more rounds than this can never succeed.
+		 */
+		static const unsigned int maxRounds = 4;
+
+		const auto &entries = record.entries;
+
+		SimulationResult result;
+		result.transition = SubrecordTransition{ SubrecordAction::Subrecord, false, false, 0, nullptr, nullptr, 0 };
+
+		auto position = m_states[state].position;
+		bool inArray = m_states[state].arrayPosition >= 0;
+		size_t arrayPosition = inArray ? static_cast<size_t>(m_states[state].arrayPosition) : 0;
+		bool arrayOpen = inArray;
+		bool hasMember = inArray;
+
+		if (position == entries.size()) {
+			result.outcome = Outcome::ExpectedEOF;
+			return result;
+		}
+
+		for (unsigned int round = 0; round < maxRounds; round++) {
+			auto currentArray = std::get_if<SubrecordArrayDefinition>(&entries[position]);
+			if (currentArray && !inArray) {
+				arrayPosition = 0;
+				inArray = true;
+			}
+
+			bool found = false;
+
+			if (currentArray) {
+				for (auto index = arrayPosition; index < currentArray->subrecords.size(); index++) {
+					const auto &subrecordDesc = currentArray->subrecords[index];
+					if (subrecordDesc.fourcc == fourcc) {
+						arrayPosition = index;
+						found = true;
+						break;
+					}
+					else if (subrecordDesc.required) {
+						break;
+					}
+				}
+
+				if (!found && std::find(currentArray->leader.begin(), currentArray->leader.end(), fourcc) != currentArray->leader.end()) {
+					for (auto index = arrayPosition; index < currentArray->subrecords.size(); index++) {
+						const auto &subrecordDesc = currentArray->subrecords[index];
+						if (subrecordDesc.required) {
+							result.outcome = Outcome::EarlyArrayRestart;
+							result.position = position;
+							result.currentArray = currentArray;
+							result.arrayPosition = index;
+							return result;
+						}
+					}
+
+					result.transition.pushMember = true;
+					hasMember = true;
+					arrayPosition = 0;
+				}
+			}
+
+			if (!found) {
+				for (auto index = position; index < entries.size(); index++) {
+					if (auto subrecordDesc = std::get_if<SubrecordDefinition>(&entries[index])) {
+						if (subrecordDesc->fourcc == fourcc) {
+							found = true;
+						}
+						else if (subrecordDesc->required) {
+							break;
+						}
+					}
+					else {
+						const auto &arrayDesc = std::get<SubrecordArrayDefinition>(entries[index]);
+						found = std::find(arrayDesc.leader.begin(), arrayDesc.leader.end(), fourcc) != arrayDesc.leader.end();
+					}
+
+					if (found) {
+						position = index;
+						inArray = false;
+						currentArray = nullptr;
+						arrayOpen = false;
+						hasMember = false;
+						break;
+					}
+				}
+
+				if (!found) {
+					result.outcome = Outcome::UnexpectedSubrecord;
+					result.position = position;
+					result.currentArray = currentArray;
+					result.arrayPosition = arrayPosition;
+					return result;
+				}
+			}
+
+			if (currentArray) {
+				auto &transition = result.transition;
+				transition.action = SubrecordAction::ArraySubrecord;
+				transition.openArray = !arrayOpen;
+				transition.pushMember = transition.pushMember || !hasMember;
+				transition.subrecord = &currentArray->subrecords[arrayPosition];
+				transition.array = currentArray;
+				transition.arraySlot = record.layout.slot(currentArray->name);
+				transition.nextState = stateId(position, static_cast<ptrdiff_t>(arrayPosition + 1));
+
+				result.outcome = Outcome::Transition;
+				return result;
+			}
+			else if (auto subrecordDesc = std::get_if<SubrecordDefinition>(&entries[position])) {
+				auto &transition = result.transition;
+				transition.action = SubrecordAction::Subrecord;
+				transition.subrecord = subrecordDesc;
+				transition.nextState = stateId(position + 1, -1);
+
+				result.outcome = Outcome::Transition;
+				return result;
+			}
+		}
+
+		result.outcome = Outcome::UnexpectedSubrecord;
+		result.position = position;
+		result.currentArray = nullptr;
+		result.arrayPosition = 0;
+		return result;
+	}
+
+	bool SubrecordStateMachine::referenceTransition(const RecordDefinition &record, uint32_t state, uint32_t fourcc, SubrecordTransition &transition) const {
+		auto result = simulate(record, state, fourcc);
+		if (result.outcome != Outcome::Transition)
+			return false;
+
+		transition = result.transition;
+		return true;
+	}
+
+	std::string SubrecordStateMachine::describeError(const RecordDefinition &record, uint32_t state, uint32_t fourcc, const std::string &chain) const {
+		auto result = simulate(record, state, fourcc);
+
+		std::stringstream error;
+
+		switch (result.outcome) {
+		case Outcome::ExpectedEOF:
+			error << record.name << ": EOF expected, got " << chain;
+			break;
+
+		case Outcome::EarlyArrayRestart:
+			error << record.name << ": unexpected subrecord (early array restart): " << chain << ": expected " << fourCCToString(result.currentArray->subrecords[result.arrayPosition].fourcc);
+			break;
+
+		case Outcome::UnexpectedSubrecord:
+		{
+			error << record.name << ": unexpected subrecord: " << chain << ": expected";
+
+			bool walkOutsideArray = true;
+
+			if (result.currentArray) {
+				const auto &subrecords = result.currentArray->subrecords;
+
+				for (auto index = result.arrayPosition; index < subrecords.size(); index++) {
+					error << " " << fourCCToString(subrecords[index].fourcc);
+
+					if (subrecords[index].required) {
+						if (index != 0)
+							walkOutsideArray = false;
+
+						break;
+					}
+				}
+			}
+
+			if (walkOutsideArray) {
+				for (auto index = result.position; index < record.entries.size(); index++) {
+					if (auto subrecordDesc = std::get_if<SubrecordDefinition>(&record.entries[index])) {
+						error << " " << fourCCToString(subrecordDesc->fourcc);
+
+						if (subrecordDesc->required)
+							break;
+					}
+					else {
+						for (auto entry : std::get<SubrecordArrayDefinition>(record.entries[index]).leader) {
+							error << " " << fourCCToString(entry);
+						}
+					}
+				}
+			}
+
+			break;
+		}
+
+		default:
+			error << record.name << ": internal error: subrecord was expected to be rejected";
+			break;
+		}
+
+		return error.str();
+	}
+}
@@ -2,176 +2,186 @@
 #include <tesparse/StringConversions.h>
 #include <tesparse/FourCC.h>
 #include <tesparse/ExpressionParser.h>
+#include <tesparse/FileMapping.h>
 
 #include <sstream>
 
 namespace tesparse {
 
-	TESFileFormatDescription::TESFileFormatDescription() = default;
+	TESFileFormatDescription::TESFileFormatDescription() : m_stringEncoding(StringEncoding::UTF8), m_sourceHash(0) {
+
+	}
 
 	TESFileFormatDescription::~TESFileFormatDescription() = default;
 
 	void TESFileFormatDescription::loadFromFile(const std::string_view &filename) {
-		IStreamPtr stream;
+		FileMapping source(filename);
+		auto data = static_cast<const unsigned char *>(source.base());
 
-		checkHR(SHCreateStreamOnFile(
-			utf8ToWide(filename).c_str(),
-			STGM_READ | STGM_SHARE_DENY_WRITE,
-			&stream));
+		parseDocument(data, source.size());
 
-		parseStream(std::move(stream));
+		m_sourceHash = contentHash(data, source.size());
 	}
 
-	void TESFileFormatDescription::loadFromMemory(const unsigned char *data, unsigned int dataSize) {
-		IStreamPtr stream;
+	void TESFileFormatDescription::loadFromFile(const std::string_view &filename, const std::string_view &cacheFilename) {
+		FileMapping source(filename);
+		auto sourceData = static_cast<const unsigned char *>(source.base());
+		auto sourceHash = contentHash(sourceData, source.size());
+
+		/*
+		 * A cache that can't be read or doesn't match is simply rebuilt; this
+		 * also covers a cache left incomplete by an interrupted write.
+		 */
+		try {
+			FileMapping cache(cacheFilename);
+			auto data = static_cast<const unsigned char *>(cache.base());
+
+			uint64_t cacheSourceHash;
+			if (readBinaryHeader(data, cache.size(), cacheSourceHash) && cacheSourceHash == sourceHash) {
+				loadBinary(data, cache.size());
+				return;
+			}
+		}
+		catch (const std::exception &) {
+		}
 
-		stream = SHCreateMemStream(data, dataSize);
-		if (!stream)
-			checkHR(E_OUTOFMEMORY);
+		parseDocument(sourceData, source.size());
 
-		parseStream(std::move(stream));
-	}
+		m_sourceHash = sourceHash;
 
-	void TESFileFormatDescription::checkHR(HRESULT hr) {
-		if (FAILED(hr))
-			_com_raise_error(hr);
+		writeCache(cacheFilename);
 	}
 
-	std::wstring_view TESFileFormatDescription::getLocalName(const IXmlReaderPtr &reader) {
-		const wchar_t *name;
-		unsigned int nameSize;
+	void TESFileFormatDescription::loadFromMemory(const unsigned char *data, unsigned int dataSize) {
+		uint64_t sourceHash;
+		if (readBinaryHeader(data, dataSize, sourceHash)) {
+			loadBinary(data, dataSize);
+			return;
+		}
+
+		parseDocument(data, dataSize);
 
-		checkHR(reader->GetLocalName(&name, &nameSize));
+		m_sourceHash = contentHash(data, dataSize);
+	}
 
-		return std::wstring_view(name, nameSize);
+	void TESFileFormatDescription::clear() {
+		m_headerRecord.clear();
+		m_stringEncoding = StringEncoding::UTF8;
+		m_sourceHash = 0;
+		m_structs.clear();
+		m_records.clear();
 	}
 
-	void TESFileFormatDescription::expectElement(const IXmlReaderPtr &reader, const std::wstring_view &name) {
-		auto actualName = getLocalName(reader);
+	void TESFileFormatDescription::expectElement(XmlPullParser &reader, const std::string_view &name) {
+		auto &actualName = reader.name();
 		if (name != actualName) {
 			std::stringstream error;
-			error << "Unexpected element: expected " << wideToUtf8(name) << ", got " << wideToUtf8(actualName);
+			error << "Unexpected element: expected " << name << ", got " << actualName;
 			throw std::runtime_error(error.str());
 		}
 	}
 
-	void TESFileFormatDescription::readAndExpectType(const IXmlReaderPtr &reader, XmlNodeType expectedType) {
-		XmlNodeType type;
-		do {
-			auto hr = reader->Read(&type);
-			if (hr == S_FALSE)
-				throw std::runtime_error("unexpected EOF");
-			checkHR(hr);
-		} while (
-			type == XmlNodeType_ProcessingInstruction ||
-			type == XmlNodeType_Comment ||
-			type == XmlNodeType_DocumentType ||
-			type == XmlNodeType_Whitespace ||
-			type == XmlNodeType_XmlDeclaration
-		);
+	void TESFileFormatDescription::readAndExpectType(XmlPullParser &reader, XmlNodeType expectedType) {
+		auto type = reader.read();
+		if (type == XmlNodeType::None)
+			throw std::runtime_error("unexpected EOF");
 
 		if (type != expectedType) {
 			std::stringstream error;
-			error << "Unexpected node type: expected " << expectedType << ", got " << type;
+			error << "Unexpected node type: expected " << XmlPullParser::nodeTypeName(expectedType) << ", got " << XmlPullParser::nodeTypeName(type);
 			throw std::runtime_error(error.str());
 		}
 	}
 
-	bool TESFileFormatDescription::iterateOnChildElements(const IXmlReaderPtr &reader) {
-		XmlNodeType type;
-		do {
-			auto hr = reader->Read(&type);
-			if (hr == S_FALSE)
-				throw std::runtime_error("unexpected EOF");
-			checkHR(hr);
-		} while (
-			type == XmlNodeType_ProcessingInstruction ||
-			type == XmlNodeType_Comment ||
-			type == XmlNodeType_DocumentType ||
-			type == XmlNodeType_Whitespace ||
-			type == XmlNodeType_XmlDeclaration
-		);
-
-		if (type == XmlNodeType_EndElement)
+	bool TESFileFormatDescription::iterateOnChildElements(XmlPullParser &reader) {
+		auto type = reader.read();
+		if (type == XmlNodeType::None)
+			throw std::runtime_error("unexpected EOF");
+
+		if (type == XmlNodeType::EndElement)
 			return false;
 
-		if(type != XmlNodeType_Element) {
+		if(type != XmlNodeType::Element) {
 			std::stringstream error;
-			error << "Unexpected node type: expected Element or EndElement, got " << type;
+			error << "Unexpected node type: expected Element or EndElement, got " << XmlPullParser::nodeTypeName(type);
 			throw std::runtime_error(error.str());
 		}
 
 		return true;
 	}
 
-	std::wstring_view TESFileFormatDescription::getNamedAttribute(const IXmlReaderPtr &reader, const std::wstring &attributeName) {
-		auto hr = reader->MoveToAttributeByName(attributeName.c_str(), nullptr);
-		checkHR(hr);
-		if (hr == S_FALSE) {
+	std::string_view TESFileFormatDescription::getNamedAttribute(const XmlPullParser &reader, const std::string_view &attributeName) {
+		std::string_view value;
+
+		if (!tryGetNamedAttribute(reader, attributeName, value)) {
 			std::stringstream error;
-			error << "Unexpected node type: required attribute was not found: " << wideToUtf8(attributeName);
+			error << "Unexpected node type: required attribute was not found: " << attributeName;
 			throw std::runtime_error(error.str());
 		}
 
-		const wchar_t *value;
-		unsigned int valueSize;
-
-		checkHR(reader->GetValue(&value, &valueSize));
+		return value;
+	}
 
-		return std::wstring_view(value, valueSize);
+	bool TESFileFormatDescription::tryGetNamedAttribute(const XmlPullParser &reader, const std::string_view &attributeName, std::string_view &value) {
+		return reader.tryGetAttribute(attributeName, value);
 	}
 
-	void TESFileFormatDescription::expectEmptyElement(const IXmlReaderPtr &reader) {
-		if (!reader->IsEmptyElement())
+	void TESFileFormatDescription::expectEmptyElement(XmlPullParser &reader) {
+		if (!reader.isEmptyElement())
 			throw std::runtime_error("Empty element expected");
 	}
 
-	void TESFileFormatDescription::expectNonEmptyElement(const IXmlReaderPtr &reader) {
-		if (reader->IsEmptyElement())
+	void TESFileFormatDescription::expectNonEmptyElement(XmlPullParser &reader) {
+		if (reader.isEmptyElement())
 			throw std::runtime_error("Non-empty element expected");
 	}
 
-	void TESFileFormatDescription::parseStream(IStreamPtr &&stream) {
-		IXmlReaderPtr reader;
+	void TESFileFormatDescription::parseDocument(const unsigned char *data, size_t dataSize) {
+		clear();
+
+		XmlPullParser reader(reinterpret_cast<const char *>(data), dataSize);
 
-		checkHR(CreateXmlReader(IID_PPV_ARGS(&reader), nullptr));
-		checkHR(reader->SetProperty(XmlReaderProperty_DtdProcessing, DtdProcessing_Parse));
-		checkHR(reader->SetInput(stream));
+		readAndExpectType(reader, XmlNodeType::Element);
+		expectElement(reader, "Layout");
+
+		m_stringEncoding = StringEncoding::UTF8;
+
+		std::string_view encoding;
+		if (tryGetNamedAttribute(reader, "Encoding", encoding)) {
+			m_stringEncoding = parseStringEncoding(encoding);
+		}
 
-		readAndExpectType(reader, XmlNodeType_Element);
-		expectElement(reader, L"Layout");
 		expectNonEmptyElement(reader);
 
-		readAndExpectType(reader, XmlNodeType_Element);
-		expectElement(reader, L"RecordOrder");
+		readAndExpectType(reader, XmlNodeType::Element);
+		expectElement(reader, "RecordOrder");
 		expectNonEmptyElement(reader);
 
-		readAndExpectType(reader, XmlNodeType_Element);
-		expectElement(reader, L"Header");
-		m_headerRecord = wideToUtf8(getNamedAttribute(reader, L"Name"));
-		checkHR(reader->MoveToElement());
+		readAndExpectType(reader, XmlNodeType::Element);
+		expectElement(reader, "Header");
+		m_headerRecord = getNamedAttribute(reader, "Name");
 		expectEmptyElement(reader);
 
-		readAndExpectType(reader, XmlNodeType_EndElement);
+		readAndExpectType(reader, XmlNodeType::EndElement);
 
 		/* RecordOrder ends here */
 
-		readAndExpectType(reader, XmlNodeType_Element);
-		expectElement(reader, L"Types");
+		readAndExpectType(reader, XmlNodeType::Element);
+		expectElement(reader, "Types");
 
-		if (!reader->IsEmptyElement()) {
+		if (!reader.isEmptyElement()) {
 			while (iterateOnChildElements(reader)) {
-				auto name = getLocalName(reader);
+				auto name = reader.name();
 
-				if (name == L"Struct") {
+				if (name == "Struct") {
 					parseStruct(reader);
 				}
-				else if (name == L"Record") {
+				else if (name == "Record") {
 					parseRecord(reader);
 				}
 				else {
 					std::stringstream error;
-					error << "Unsupported type element: " << wideToUtf8(name);
+					error << "Unsupported type element: " << name;
 					throw std::runtime_error(error.str());
 				}
 			}
@@ -179,49 +189,44 @@ namespace tesparse {
 
 		/* Types end here */
 
-		readAndExpectType(reader, XmlNodeType_EndElement);
+		readAndExpectType(reader, XmlNodeType::EndElement);
 
 		/* Layout ends here */
+
+		compile();
 	}
 
-	void TESFileFormatDescription::parseField(const IXmlReaderPtr &reader, FieldDefinition &field) {
-		static const std::unordered_map<std::wstring_view, FieldType> fieldTypeMap{
-			{ L"FourCC", FieldType::FourCC },
-			{ L"Int8", FieldType::Int8 },
-			{ L"UInt8", FieldType::UInt8 },
-			{ L"UInt16", FieldType::UInt16 },
-			{ L"Int32", FieldType::Int32 },
-			{ L"UInt32", FieldType::UInt32 },
-			{ L"Float", FieldType::Float },
-			{ L"ByteArray", FieldType::ByteArray },
-			{ L"String", FieldType::String },
-			{ L"Array", FieldType::Array },
-			{ L"StructRef", FieldType::StructRef }
+	void TESFileFormatDescription::parseField(XmlPullParser &reader, FieldDefinition &field) {
+		static const std::unordered_map<std::string_view, FieldType> fieldTypeMap{
+			{ "FourCC", FieldType::FourCC },
+			{ "Int8", FieldType::Int8 },
+			{ "UInt8", FieldType::UInt8 },
+			{ "UInt16", FieldType::UInt16 },
+			{ "Int32", FieldType::Int32 },
+			{ "UInt32", FieldType::UInt32 },
+			{ "Float", FieldType::Float },
+			{ "ByteArray", FieldType::ByteArray },
+			{ "String", FieldType::String },
+			{ "Array", FieldType::Array },
+			{ "StructRef", FieldType::StructRef }
 		};
 
 		expectNonEmptyElement(reader);
 
-		readAndExpectType(reader, XmlNodeType_Element);
-		auto name = getLocalName(reader);
+		readAndExpectType(reader, XmlNodeType::Element);
+		auto name = reader.name();
 		auto it = fieldTypeMap.find(name);
 		if (it == fieldTypeMap.end()) {
-			std::stringstream stream;
-			stream << "Unsupported field type: " << wideToUtf8(name);
+			std::stringstream error;
+			error << "Unsupported field type: " << name;
+			throw std::runtime_error(error.str());
 		}
 
 		field.type = it->second;
 
 		if (field.type == FieldType::Array || field.type == FieldType::ByteArray || field.type == FieldType::String) {
-			auto hr = reader->MoveToAttributeByName(L"Length", nullptr);
-			checkHR(hr);
-			if (hr != S_FALSE) {
-				const wchar_t *value;
-				unsigned int valueSize;
-
-				checkHR(reader->GetValue(&value, &valueSize));
-
-				auto expression = wideToUtf8(std::wstring_view(value, valueSize));
-
+			std::string_view expression;
+			if (tryGetNamedAttribute(reader, "Length", expression)) {
 				ExpressionParser parser;
 				try {
 					parser.parse(expression);
@@ -233,14 +238,11 @@ namespace tesparse {
 				}
 
 				field.length = std::move(parser.expression());
-
-				checkHR(reader->MoveToElement());
 			}
 		}
 
 		if (field.type == FieldType::StructRef) {
-			field.structName = wideToUtf8(getNamedAttribute(reader, L"Name"));
-			checkHR(reader->MoveToElement());
+			field.structName = getNamedAttribute(reader, "Name");
 		}
 
 		if (field.type == FieldType::Array) {
@@ -253,19 +255,18 @@ namespace tesparse {
 			expectEmptyElement(reader);
 		}
 
-		readAndExpectType(reader, XmlNodeType_EndElement);
+		readAndExpectType(reader, XmlNodeType::EndElement);
 	}
 
-	void TESFileFormatDescription::parseFields(const IXmlReaderPtr &reader, std::vector<FieldDefinition> &fields) {
+	void TESFileFormatDescription::parseFields(XmlPullParser &reader, std::vector<FieldDefinition> &fields) {
 
 
-		if (!reader->IsEmptyElement()) {
+		if (!reader.isEmptyElement()) {
 			while (iterateOnChildElements(reader)) {
-				expectElement(reader, L"Field");
+				expectElement(reader, "Field");
 
 				auto &field = fields.emplace_back();
-				field.name = wideToUtf8(getNamedAttribute(reader, L"Name"));
-				checkHR(reader->MoveToElement());
+				field.name = getNamedAttribute(reader, "Name");
 
 				parseField(reader, field);
 
@@ -273,34 +274,32 @@ namespace tesparse {
 		}
 	}
 
-	void TESFileFormatDescription::parseStruct(const IXmlReaderPtr &reader) {
-		auto structName = getNamedAttribute(reader, L"Name");
-		auto &st = m_structs.emplace(wideToUtf8(structName), StructDefinition{}).first->second;
+	void TESFileFormatDescription::parseStruct(XmlPullParser &reader) {
+		auto structName = getNamedAttribute(reader, "Name");
+		auto &st = m_structs.emplace(std::string(structName), StructDefinition{}).first->second;
 
-		checkHR(reader->MoveToElement());
 		
 		parseFields(reader, st.fields);
 	}
 	
-	void TESFileFormatDescription::parseRecord(const IXmlReaderPtr &reader) {
-		auto fourCC = fourCCFromString(wideToUtf8(getNamedAttribute(reader, L"FourCC")));
+	void TESFileFormatDescription::parseRecord(XmlPullParser &reader) {
+		auto fourCC = fourCCFromString(getNamedAttribute(reader, "FourCC"));
 
 		auto &record = m_records.emplace(fourCC, RecordDefinition{}).first->second;
-		record.name = wideToUtf8(getNamedAttribute(reader, L"Name"));
-		checkHR(reader->MoveToElement());
+		record.name = getNamedAttribute(reader, "Name");
 
-		if (!reader->IsEmptyElement()) {
+		if (!reader.isEmptyElement()) {
 			while (iterateOnChildElements(reader)) {
-				auto name = getLocalName(reader);
+				auto name = reader.name();
 
-				if (name == L"Subrecord") {
+				if (name == "Subrecord") {
 					SubrecordDefinition subrecord;
 
 					parseSubrecord(reader, subrecord);
 
 					record.entries.emplace_back(std::move(subrecord));
 				}
-				else if(name == L"SubrecordArray") {
+				else if(name == "SubrecordArray") {
 					SubrecordArrayDefinition subrecord;
 
 					parseSubrecordArray(reader, subrecord);
@@ -309,29 +308,27 @@ namespace tesparse {
 				}
 				else {
 					std::stringstream error;
-					error << "Unsupported element in record: " << wideToUtf8(name);
+					error << "Unsupported element in record: " << name;
 					throw std::runtime_error(error.str());
 				}
 			}
 		}
 	}
 
-	void TESFileFormatDescription::parseSubrecord(const IXmlReaderPtr &reader, SubrecordDefinition &definition) {
-		definition.fourcc = fourCCFromString(wideToUtf8(getNamedAttribute(reader, L"FourCC")));
-		definition.required = getNamedAttribute(reader, L"Presence") == L"Required";
-		checkHR(reader->MoveToElement());
+	void TESFileFormatDescription::parseSubrecord(XmlPullParser &reader, SubrecordDefinition &definition) {
+		definition.fourcc = fourCCFromString(getNamedAttribute(reader, "FourCC"));
+		definition.required = getNamedAttribute(reader, "Presence") == "Required";
 
 		parseFields(reader, definition.fields);
 	}
 
-	void TESFileFormatDescription::parseSubrecordArray(const IXmlReaderPtr &reader, SubrecordArrayDefinition &definition) {
-		definition.name = wideToUtf8(getNamedAttribute(reader, L"Name"));
-		definition.leader = fourCCSetFromString(wideToUtf8(getNamedAttribute(reader, L"Leader")));
-		checkHR(reader->MoveToElement());
+	void TESFileFormatDescription::parseSubrecordArray(XmlPullParser &reader, SubrecordArrayDefinition &definition) {
+		definition.name = getNamedAttribute(reader, "Name");
+		definition.leader = fourCCSetFromString(getNamedAttribute(reader, "Leader"));
 
-		if (!reader->IsEmptyElement()) {
+		if (!reader.isEmptyElement()) {
 			while (iterateOnChildElements(reader)) {
-				expectElement(reader, L"Subrecord");
+				expectElement(reader, "Subrecord");
 
 				auto &subrecord = definition.subrecords.emplace_back();
 				parseSubrecord(reader, subrecord);
@@ -339,6 +336,249 @@ namespace tesparse {
 		}
 	}
 
+	/*
+	 * Flattens every struct and subrecord layout into a DecodingProgram, so
+	 * that decoding doesn't need to walk FieldDefinition trees or look up
+	 * structures by name, and builds the subrecord matching table of every
+	 * record.
+	 */
+	void TESFileFormatDescription::compile() {
+		std::unordered_set<const StructDefinition *> compiling;
+
+		for (auto &pair : m_structs) {
+			compileStruct(pair.second, compiling);
+		}
+
+		/*
+		 * Record contents carry the non-framing fields of the Record
+		 * structure, so every record layout starts with the Record structure's
+		 * fields in the same slots.
+		 */
+		const auto &recordStruct = getStructByName("Record");
+
+		/*
+		 * A field's presence tells which subrecord it came from, so that
+		 * records can be encoded back, only if no two subrecords share a
+		 * field. Name, Size and Data of the Record structure are framing and
+		 * are free for subrecord fields to reuse.
+		 */
+		std::unordered_set<std::string> recordHeaderFields;
+		for (TESFieldSlot slot = 0; slot < recordStruct.layout.size(); slot++) {
+			std::string name(recordStruct.layout.fieldName(slot));
+			if (name != "Name" && name != "Size" && name != "Data") {
+				recordHeaderFields.insert(std::move(name));
+			}
+		}
+
+		for (auto &pair : m_records) {
+			auto &record = pair.second;
+			record.fourcc = pair.first;
+
+			auto &layout = record.layout;
+
+			for (TESFieldSlot slot = 0; slot < recordStruct.layout.size(); slot++) {
+				layout.addField(recordStruct.layout.fieldName(slot));
+			}
+
+			auto claimFieldName = [&](std::unordered_set<std::string> &names, const std::string &name) {
+				if (!names.insert(name).second) {
+					std::stringstream error;
+					error << "Field " << name << " is defined more than once in record " << record.name;
+					throw std::runtime_error(error.str());
+				}
+			};
+
+			auto recordFields = recordHeaderFields;
+
+			for (auto &entry : record.entries) {
+				if (auto subrecord = std::get_if<SubrecordDefinition>(&entry)) {
+					for (const auto &field : subrecord->fields) {
+						claimFieldName(recordFields, field.name);
+					}
+
+					compileFields(subrecord->fields, subrecord->program, layout, compiling);
+				}
+				else {
+					auto &array = std::get<SubrecordArrayDefinition>(entry);
+
+					claimFieldName(recordFields, array.name);
+					layout.addField(array.name);
+
+					std::unordered_set<std::string> memberFields;
+
+					for (auto &arraySubrecord : array.subrecords) {
+						for (const auto &field : arraySubrecord.fields) {
+							claimFieldName(memberFields, field.name);
+						}
+
+						compileFields(arraySubrecord.fields, arraySubrecord.program, array.memberLayout, compiling);
+					}
+				}
+			}
+
+			record.stateMachine.build(record);
+		}
+	}
+
+	/*
+	 * A structure that is being compiled already has the instructions of its
+	 * fields before the current one, so it has to be checked for recursion
+	 * before it is taken as compiled.
+	 */
+	void TESFileFormatDescription::compileStruct(StructDefinition &definition, std::unordered_set<const StructDefinition *> &compiling) {
+		if (compiling.count(&definition) != 0)
+			throw std::runtime_error("Recursive structure reference");
+
+		if (!definition.program.instructions.empty())
+			return;
+
+		compiling.insert(&definition);
+
+		compileFields(definition.fields, definition.program, definition.layout, compiling);
+
+		compiling.erase(&definition);
+	}
+
+	void TESFileFormatDescription::compileFields(std::vector<FieldDefinition> &fields, DecodingProgram &program, TESStructLayout &layout, std::unordered_set<const StructDefinition *> &compiling) {
+		size_t fixedSize = 0;
+
+		for (auto &field : fields) {
+			auto fieldSize = compileField(field, layout.addField(field.name), program, layout, compiling);
+
+			if (fieldSize == DecodingInstruction::VariableSize || fixedSize == DecodingInstruction::VariableSize)
+				fixedSize = DecodingInstruction::VariableSize;
+			else
+				fixedSize += fieldSize;
+		}
+
+		program.fixedSize = fixedSize;
+	}
+
+	size_t TESFileFormatDescription::compileField(FieldDefinition &field, TESFieldSlot slot, DecodingProgram &program, TESStructLayout &layout, std::unordered_set<const StructDefinition *> &compiling) {
+		static const size_t variableSize = DecodingInstruction::VariableSize;
+
+		auto index = program.instructions.size();
+
+		{
+			auto &instruction = program.instructions.emplace_back();
+			instruction.lengthSource = LengthSource::Remaining;
+			instruction.span = 1;
+			instruction.fixedSize = variableSize;
+			instruction.slot = slot;
+			instruction.constantLength = 0;
+			instruction.lengthExpression = nullptr;
+			instruction.structProgram = nullptr;
+			instruction.structLayout = nullptr;
+
+			if ((field.type == FieldType::ByteArray || field.type == FieldType::String || field.type == FieldType::Array) && !field.length.empty()) {
+				try {
+					field.compiledLength = ExpressionEvaluator::compile(field.length, layout);
+				}
+				catch (const std::exception &e) {
+					std::stringstream error;
+					error << "Invalid length expression of " << field.name << ": " << e.what();
+					throw std::runtime_error(error.str());
+				}
+
+				const auto &steps = field.compiledLength.steps;
+				if (steps.size() == 1 && steps.front().kind == ExpressionStepKind::Constant && steps.front().constant >= 0) {
+					instruction.lengthSource = LengthSource::Constant;
+					instruction.constantLength = steps.front().constant;
+				}
+				else {
+					instruction.lengthSource = LengthSource::Expression;
+					instruction.lengthExpression = &field.compiledLength;
+				}
+			}
+
+			switch (field.type) {
+			case FieldType::FourCC:
+			case FieldType::UInt32:
+				instruction.opcode = DecodingOpcode::UInt32;
+				instruction.fixedSize = sizeof(uint32_t);
+				break;
+
+			case FieldType::Int8:
+				instruction.opcode = DecodingOpcode::Int8;
+				instruction.fixedSize = sizeof(int8_t);
+				break;
+
+			case FieldType::UInt8:
+				instruction.opcode = DecodingOpcode::UInt8;
+				instruction.fixedSize = sizeof(uint8_t);
+				break;
+
+			case FieldType::UInt16:
+				instruction.opcode = DecodingOpcode::UInt16;
+				instruction.fixedSize = sizeof(uint16_t);
+				break;
+
+			case FieldType::Int32:
+				instruction.opcode = DecodingOpcode::Int32;
+				instruction.fixedSize = sizeof(int32_t);
+				break;
+
+			case FieldType::Float:
+				instruction.opcode = DecodingOpcode::Float;
+				instruction.fixedSize = sizeof(float);
+				break;
+
+			case FieldType::ByteArray:
+			case FieldType::String:
+				instruction.opcode = field.type == FieldType::ByteArray ? DecodingOpcode::ByteArray : DecodingOpcode::String;
+				if (instruction.lengthSource == LengthSource::Constant)
+					instruction.fixedSize = static_cast<size_t>(instruction.constantLength);
+				break;
+
+			case FieldType::Array:
+				instruction.opcode = DecodingOpcode::Array;
+				break;
+
+			case FieldType::StructRef:
+			{
+				auto it = m_structs.find(field.structName);
+				if (it == m_structs.end()) {
+					std::stringstream error;
+					error << "Undefined structure: " << field.structName;
+					throw std::logic_error(error.str());
+				}
+
+				auto &structDef = it->second;
+				compileStruct(structDef, compiling);
+
+				instruction.opcode = DecodingOpcode::Struct;
+				instruction.structProgram = &structDef.program;
+				instruction.structLayout = &structDef.layout;
+				instruction.fixedSize = structDef.program.fixedSize;
+				break;
+			}
+
+			default:
+			{
+				std::stringstream error;
+				error << "Unsupported field type: " << static_cast<unsigned int>(field.type);
+				throw std::runtime_error(error.str());
+			}
+			}
+		}
+
+		/*
+		 * The element is appended after the array instruction itself, which
+		 * may reallocate the instruction vector; hence the re-lookups by index.
+		 */
+		if (field.type == FieldType::Array) {
+			auto elementSize = compileField(*field.dataType, 0, program, layout, compiling);
+
+			auto &instruction = program.instructions[index];
+			instruction.span = program.instructions.size() - index;
+
+			if (instruction.lengthSource == LengthSource::Constant && elementSize != variableSize)
+				instruction.fixedSize = elementSize * static_cast<size_t>(instruction.constantLength);
+		}
+
+		return program.instructions[index].fixedSize;
+	}
+
 	const StructDefinition &TESFileFormatDescription::getStructByName(const std::string &name) const {
 		auto it = m_structs.find(name);
 		if (it == m_structs.end()) {
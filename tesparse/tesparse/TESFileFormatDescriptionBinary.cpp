@@ -0,0 +1,369 @@
+#include <tesparse/TESFileFormatDescription.h>
+#include <tesparse/InputSerializationStream.h>
+#include <tesparse/OutputSerializationStream.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+/*
+ * Binary form of a description. It holds the parsed definitions, which are
+ * compiled on load exactly as after parsing XML; length expressions are
+ * stored already converted to postfix form. The compiled decoding programs
+ * and subrecord state machines are full of internal pointers and are not
+ * stored, so compiling takes most of the time of loading the binary form
+ * (see DescriptionLoadBenchmark).
+ *
+ * Header:
+ *   uint32 signature ('TESD')
+ *   uint32 version
+ *   uint64 content hash of the XML source
+ *   uint32 payload size
+ * Payload:
+ *   string header record, uint8 string encoding,
+ *   uint32 structure count, then for each: string name, fields
+ *   uint32 record count, then for each: uint32 FourCC, string name, uint32
+ *   entry count, and entries: uint8 0 and a subrecord, or uint8 1, string
+ *   array name, uint32 leader count, leader FourCCs, uint32 subrecord count
+ *   and subrecords
+ * Subrecord: uint32 FourCC, uint8 required, fields
+ * Fields: uint32 count, then for each: string name, uint8 type, uint32 token
+ * count and tokens (uint8 0 and uint8 operator, uint8 1 and int32 integer,
+ * or uint8 2 and string variable), string structure name, uint8 element
+ * present, element field
+ */
+
+namespace tesparse {
+	static const uint32_t binarySignature = 0x44534554; // 'TESD'
+
+	enum class BinaryEntryType : uint8_t {
+		Subrecord,
+		SubrecordArray
+	};
+
+	enum class BinaryTokenType : uint8_t {
+		Operator,
+		Integer,
+		Variable
+	};
+
+	uint64_t TESFileFormatDescription::contentHash(const unsigned char *data, size_t size) {
+		uint64_t hash = 14695981039346656037ULL;
+
+		for (size_t index = 0; index < size; index++) {
+			hash ^= data[index];
+			hash *= 1099511628211ULL;
+		}
+
+		return hash;
+	}
+
+	bool TESFileFormatDescription::readBinaryHeader(const unsigned char *data, size_t dataSize, uint64_t &sourceHash) {
+		if (dataSize < BinaryHeaderSize)
+			return false;
+
+		InputSerializationStream stream(data, data + dataSize);
+
+		uint32_t signature, version, payloadSize;
+		stream >> signature >> version >> sourceHash >> payloadSize;
+
+		return signature == binarySignature && version == BinaryVersion && payloadSize == dataSize - BinaryHeaderSize;
+	}
+
+	std::vector<unsigned char> TESFileFormatDescription::serialize() const {
+		OutputSerializationStream stream;
+
+		stream << binarySignature << BinaryVersion << m_sourceHash << static_cast<uint32_t>(0);
+
+		stream << m_headerRecord << static_cast<uint8_t>(m_stringEncoding);
+
+		/*
+		 * Definitions are written in key order, not in hash table order, so
+		 * that the same description always serializes to the same bytes.
+		 */
+		std::vector<const std::pair<const std::string, StructDefinition> *> structs;
+		for (const auto &pair : m_structs) {
+			structs.push_back(&pair);
+		}
+
+		std::sort(structs.begin(), structs.end(), [](const auto *left, const auto *right) { return left->first < right->first; });
+
+		std::vector<const std::pair<const uint32_t, RecordDefinition> *> records;
+		for (const auto &pair : m_records) {
+			records.push_back(&pair);
+		}
+
+		std::sort(records.begin(), records.end(), [](const auto *left, const auto *right) { return left->first < right->first; });
+
+		stream << static_cast<uint32_t>(structs.size());
+		for (const auto *pair : structs) {
+			stream << pair->first;
+			serializeFields(stream, pair->second.fields);
+		}
+
+		stream << static_cast<uint32_t>(records.size());
+		for (const auto *pair : records) {
+			const auto &record = pair->second;
+
+			stream << pair->first << record.name << static_cast<uint32_t>(record.entries.size());
+
+			for (const auto &entry : record.entries) {
+				if (auto subrecord = std::get_if<SubrecordDefinition>(&entry)) {
+					stream << BinaryEntryType::Subrecord;
+					serializeSubrecord(stream, *subrecord);
+				}
+				else {
+					const auto &array = std::get<SubrecordArrayDefinition>(entry);
+
+					stream << BinaryEntryType::SubrecordArray << array.name;
+
+					stream << static_cast<uint32_t>(array.leader.size());
+					for (auto fourcc : array.leader) {
+						stream << fourcc;
+					}
+
+					stream << static_cast<uint32_t>(array.subrecords.size());
+					for (const auto &subrecord : array.subrecords) {
+						serializeSubrecord(stream, subrecord);
+					}
+				}
+			}
+		}
+
+		auto payloadSize = static_cast<uint32_t>(stream.getCurrentPosition() - BinaryHeaderSize);
+		stream.setCurrentPosition(BinaryHeaderSize - sizeof(uint32_t));
+		stream << payloadSize;
+
+		return stream.data();
+	}
+
+	void TESFileFormatDescription::loadBinary(const unsigned char *data, size_t dataSize) {
+		clear();
+
+		InputSerializationStream stream(data, data + dataSize);
+
+		uint32_t signature, version, payloadSize;
+		stream >> signature >> version >> m_sourceHash >> payloadSize;
+
+		uint8_t encoding;
+		stream >> m_headerRecord >> encoding;
+		if (encoding > static_cast<uint8_t>(StringEncoding::Windows1252))
+			throw std::runtime_error("invalid string encoding in binary description");
+
+		m_stringEncoding = static_cast<StringEncoding>(encoding);
+
+		uint32_t structCount;
+		stream >> structCount;
+		for (uint32_t index = 0; index < structCount; index++) {
+			std::string name;
+			stream >> name;
+
+			auto &st = m_structs.emplace(std::move(name), StructDefinition{}).first->second;
+			deserializeFields(stream, st.fields);
+		}
+
+		uint32_t recordCount;
+		stream >> recordCount;
+		for (uint32_t index = 0; index < recordCount; index++) {
+			uint32_t fourcc;
+			stream >> fourcc;
+
+			auto &record = m_records.emplace(fourcc, RecordDefinition{}).first->second;
+
+			uint32_t entryCount;
+			stream >> record.name >> entryCount;
+
+			for (uint32_t entryIndex = 0; entryIndex < entryCount; entryIndex++) {
+				BinaryEntryType type;
+				stream >> type;
+
+				if (type == BinaryEntryType::Subrecord) {
+					SubrecordDefinition subrecord;
+					deserializeSubrecord(stream, subrecord);
+
+					record.entries.emplace_back(std::move(subrecord));
+				}
+				else if (type == BinaryEntryType::SubrecordArray) {
+					SubrecordArrayDefinition array;
+
+					uint32_t leaderCount;
+					stream >> array.name >> leaderCount;
+
+					array.leader.resize(leaderCount);
+					for (auto &fourcc : array.leader) {
+						stream >> fourcc;
+					}
+
+					uint32_t subrecordCount;
+					stream >> subrecordCount;
+					for (uint32_t subrecordIndex = 0; subrecordIndex < subrecordCount; subrecordIndex++) {
+						deserializeSubrecord(stream, array.subrecords.emplace_back());
+					}
+
+					record.entries.emplace_back(std::move(array));
+				}
+				else {
+					throw std::runtime_error("invalid record entry type in binary description");
+				}
+			}
+		}
+
+		if (!stream.atEnd())
+			throw std::runtime_error("trailing data in binary description");
+
+		compile();
+	}
+
+	/*
+	 * The cache is written to a temporary file and then moved into place, so
+	 * that other processes never observe a partially written cache. Failure
+	 * to write the cache is not an error: the description has loaded.
+	 */
+	void TESFileFormatDescription::writeCache(const std::string_view &cacheFilename) const {
+		auto data = serialize();
+
+		std::string filename(cacheFilename);
+		std::stringstream temporaryFilename;
+		temporaryFilename << filename << "." << std::hex << std::random_device()() << ".tmp";
+
+		{
+			std::ofstream stream(temporaryFilename.str(), std::ios::out | std::ios::trunc | std::ios::binary);
+			if (!stream)
+				return;
+
+			stream.write(reinterpret_cast<const char *>(data.data()), data.size());
+			stream.close();
+
+			if (!stream) {
+				std::remove(temporaryFilename.str().c_str());
+				return;
+			}
+		}
+
+		if (std::rename(temporaryFilename.str().c_str(), filename.c_str()) != 0) {
+			// Windows doesn't replace existing files on rename
+			std::remove(filename.c_str());
+
+			if (std::rename(temporaryFilename.str().c_str(), filename.c_str()) != 0)
+				std::remove(temporaryFilename.str().c_str());
+		}
+	}
+
+	void TESFileFormatDescription::serializeFields(SerializationStream &stream, const std::vector<FieldDefinition> &fields) {
+		stream << static_cast<uint32_t>(fields.size());
+
+		for (const auto &field : fields) {
+			serializeField(stream, field);
+		}
+	}
+
+	void TESFileFormatDescription::serializeField(SerializationStream &stream, const FieldDefinition &field) {
+		stream << field.name << static_cast<uint8_t>(field.type);
+
+		stream << static_cast<uint32_t>(field.length.size());
+		for (const auto &token : field.length) {
+			if (auto op = std::get_if<ExpressionOperator>(&token)) {
+				stream << BinaryTokenType::Operator << static_cast<uint8_t>(*op);
+			}
+			else if (auto val = std::get_if<ExpressionInteger>(&token)) {
+				stream << BinaryTokenType::Integer << *val;
+			}
+			else {
+				stream << BinaryTokenType::Variable << std::get<std::string>(token);
+			}
+		}
+
+		stream << field.structName;
+
+		stream << static_cast<uint8_t>(field.dataType ? 1 : 0);
+		if (field.dataType) {
+			serializeField(stream, *field.dataType);
+		}
+	}
+
+	void TESFileFormatDescription::serializeSubrecord(SerializationStream &stream, const SubrecordDefinition &subrecord) {
+		stream << subrecord.fourcc << static_cast<uint8_t>(subrecord.required ? 1 : 0);
+		serializeFields(stream, subrecord.fields);
+	}
+
+	void TESFileFormatDescription::deserializeFields(SerializationStream &stream, std::vector<FieldDefinition> &fields) {
+		uint32_t count;
+		stream >> count;
+
+		for (uint32_t index = 0; index < count; index++) {
+			deserializeField(stream, fields.emplace_back());
+		}
+	}
+
+	void TESFileFormatDescription::deserializeField(SerializationStream &stream, FieldDefinition &field) {
+		uint8_t type;
+		stream >> field.name >> type;
+
+		if (type > static_cast<uint8_t>(FieldType::StructRef))
+			throw std::runtime_error("invalid field type in binary description");
+
+		field.type = static_cast<FieldType>(type);
+
+		uint32_t tokenCount;
+		stream >> tokenCount;
+
+		for (uint32_t index = 0; index < tokenCount; index++) {
+			BinaryTokenType tokenType;
+			stream >> tokenType;
+
+			switch (tokenType) {
+			case BinaryTokenType::Operator:
+			{
+				uint8_t op;
+				stream >> op;
+
+				if (op > static_cast<uint8_t>(ExpressionOperator::RightShift))
+					throw std::runtime_error("invalid operator in binary description");
+
+				field.length.emplace_back(static_cast<ExpressionOperator>(op));
+				break;
+			}
+
+			case BinaryTokenType::Integer:
+			{
+				ExpressionInteger val;
+				stream >> val;
+				field.length.emplace_back(val);
+				break;
+			}
+
+			case BinaryTokenType::Variable:
+			{
+				std::string variable;
+				stream >> variable;
+				field.length.emplace_back(std::move(variable));
+				break;
+			}
+
+			default:
+				throw std::runtime_error("invalid expression token in binary description");
+			}
+		}
+
+		uint8_t hasDataType;
+		stream >> field.structName >> hasDataType;
+
+		if (hasDataType) {
+			field.dataType = std::make_unique<FieldDefinition>();
+			deserializeField(stream, *field.dataType);
+		}
+		else if (field.type == FieldType::Array) {
+			throw std::runtime_error("array without element type in binary description");
+		}
+	}
+
+	void TESFileFormatDescription::deserializeSubrecord(SerializationStream &stream, SubrecordDefinition &subrecord) {
+		uint8_t required;
+		stream >> subrecord.fourcc >> required;
+		subrecord.required = required != 0;
+
+		deserializeFields(stream, subrecord.fields);
+	}
+}
@@ -5,368 +5,851 @@
 #include <tesparse/ExpressionEvaluator.h>
 #include <tesparse/FourCC.h>
 
+#include <algorithm>
+#include <atomic>
 #include <sstream>
+#include <thread>
+#include <tuple>
 #include <unordered_set>
 
 namespace tesparse {
-	TESGameData::TESGameData() = default;
+	TESGameData::TESGameData() : m_header(nullptr), m_headerEntry{ 0, 0, nullptr, nullptr }, m_headerModified(false), m_description(nullptr), m_recordProgram(nullptr), m_subrecordProgram(nullptr),
+		m_recordLayout(nullptr), m_subrecordLayout(nullptr), m_recordNameSlot(0), m_recordSizeSlot(0), m_recordDataSlot(0), m_subrecordNameSlot(0), m_subrecordSizeSlot(0), m_subrecordDataSlot(0),
+		m_zeroCopy(false) {
 
-	TESGameData::~TESGameData() = default;
-
-	template<typename T>
-	bool inSet(T value, const std::vector<T> &set) {
-		auto it = std::find(set.begin(), set.end(), value);
-		return it != set.end();
 	}
 
-	void TESGameData::load(const std::string_view &filename, const tesparse::TESFileFormatDescription &desc) {
+	TESGameData::~TESGameData() = default;
+
+	void TESGameData::load(const std::string_view &filename, const tesparse::TESFileFormatDescription &desc, const TESLoadOptions &options) {
 		static const std::unordered_set<std::string> builtinRecordFields{ "Name", "Size", "Data" };
 
+		const auto &recordStruct = desc.getStructByName("Record");
+		const auto &subrecordStruct = desc.getStructByName("Subrecord");
+
 		m_description = &desc;
+		m_recordProgram = &recordStruct.program;
+		m_subrecordProgram = &subrecordStruct.program;
+		m_recordLayout = &recordStruct.layout;
+		m_subrecordLayout = &subrecordStruct.layout;
+		m_recordNameSlot = m_recordLayout->slot("Name");
+		m_recordSizeSlot = m_recordLayout->slot("Size");
+		m_recordDataSlot = m_recordLayout->slot("Data");
+		m_subrecordNameSlot = m_subrecordLayout->slot("Name");
+		m_subrecordSizeSlot = m_subrecordLayout->slot("Size");
+		m_subrecordDataSlot = m_subrecordLayout->slot("Data");
+
+		m_recordHeaderSlots.clear();
+		for (TESFieldSlot slot = 0; slot < m_recordLayout->size(); slot++) {
+			if (builtinRecordFields.count(m_recordLayout->fieldName(slot)) == 0) {
+				m_recordHeaderSlots.push_back(slot);
+			}
+		}
+
+		m_zeroCopy = options.zeroCopy;
+		m_header = nullptr;
+		m_records.clear();
+		m_index.clear();
+		m_skippedRecords.clear();
+		m_modified.clear();
+		m_headerModified = false;
+		m_layoutDrift.clear();
+		m_arenas.clear();
+		createArena();
+
+		buildProjections(options);
+
+		m_mapping = std::make_unique<FileMapping>(filename, options.mapping);
+
+		indexRecords(options);
+
+		if (!options.lazy) {
+			auto threads = options.threads;
+			if (threads == 0) {
+				threads = std::max(1U, std::thread::hardware_concurrency());
+			}
+
+			if (threads > 1 && m_index.size() > 1) {
+				decodeRecordsParallel(threads);
+			}
+			else {
+				for (size_t index = 0, count = m_index.size(); index < count; index++) {
+					m_records[index].second = decodeRecord(m_index[index], m_arenas.front().get());
+				}
+			}
+		}
+
+		if (!options.zeroCopy && !options.lazy && !options.passthrough && !options.mapping.writable) {
+			m_mapping.reset();
+		}
+	}
+
+	/*
+	 * Values are only ever released all at once, so a monotonic resource,
+	 * which never frees individual allocations, is sufficient.
+	 */
+	std::pmr::memory_resource *TESGameData::createArena() {
+		static const size_t initialArenaSize = 64 * 1024;
+
+		return m_arenas.emplace_back(std::make_unique<std::pmr::monotonic_buffer_resource>(initialArenaSize)).get();
+	}
+
+	/*
+	 * Resolves the projection's field paths against the record layouts.
+	 * Fields that length expressions refer to are decoded even if they are
+	 * not selected, and are cleared once the record is complete.
+	 */
+	void TESGameData::buildProjections(const TESLoadOptions &options) {
+		m_projections.clear();
+
+		for (const auto &pair : options.projection) {
+			auto recordDesc = m_description->tryGetRecordByFourCC(pair.first);
+			if (!recordDesc) {
+				std::stringstream error;
+				error << "Projection for undefined record type: " << fourCCToString(pair.first);
+				throw std::runtime_error(error.str());
+			}
+
+			auto &projection = m_projections[recordDesc];
+			projection.fields.selected.assign(recordDesc->layout.size(), false);
 
-		FileMapping mapping(filename);
+			std::unordered_map<std::string, const SubrecordArrayDefinition *> arraysByName;
+			for (const auto &entry : recordDesc->entries) {
+				if (auto array = std::get_if<SubrecordArrayDefinition>(&entry)) {
+					arraysByName.emplace(array->name, array);
+				}
+			}
+
+			for (const auto &path : pair.second) {
+				auto separator = path.find('.');
+				auto fieldName = path.substr(0, separator);
+
+				auto slot = recordDesc->layout.tryGetSlot(fieldName);
+				auto arrayIt = arraysByName.find(fieldName);
+				const TESFieldSlot *memberSlot = nullptr;
+
+				if (slot && separator != std::string::npos && arrayIt != arraysByName.end()) {
+					memberSlot = arrayIt->second->memberLayout.tryGetSlot(path.substr(separator + 1));
+				}
 
-		auto begin = static_cast<const unsigned char *>(mapping.base());
-		auto end = begin + mapping.size();
+				if (!slot || (separator != std::string::npos && !memberSlot)) {
+					std::stringstream error;
+					error << "Undefined field in projection: " << recordDesc->name << "." << path;
+					throw std::runtime_error(error.str());
+				}
+
+				projection.fields.selected[*slot] = true;
+
+				if (arrayIt != arraysByName.end()) {
+					const auto &memberLayout = arrayIt->second->memberLayout;
+
+					auto result = projection.arrays.emplace(arrayIt->second, ArrayProjection());
+					auto &array = result.first->second;
+					if (result.second) {
+						array.slot = *slot;
+						array.members.selected.assign(memberLayout.size(), false);
+					}
+
+					if (memberSlot) {
+						array.members.selected[*memberSlot] = true;
+					}
+					else {
+						array.members.selected.assign(memberLayout.size(), true);
+					}
+				}
+			}
+
+			std::unordered_set<std::string> recordVariables;
+			for (const auto &entry : recordDesc->entries) {
+				if (auto subrecord = std::get_if<SubrecordDefinition>(&entry)) {
+					collectExpressionVariables(subrecord->fields, recordVariables);
+				}
+			}
+
+			finishFieldMask(projection.fields, recordDesc->layout, recordVariables);
+
+			for (const auto &entry : recordDesc->entries) {
+				if (auto subrecord = std::get_if<SubrecordDefinition>(&entry)) {
+					if (std::none_of(subrecord->fields.begin(), subrecord->fields.end(), [&](const FieldDefinition &field) {
+						return projection.fields.decoded[recordDesc->layout.slot(field.name)];
+					})) {
+						projection.skippedSubrecords.insert(subrecord);
+					}
+				}
+				else {
+					const auto &arrayDesc = std::get<SubrecordArrayDefinition>(entry);
+
+					auto it = projection.arrays.find(&arrayDesc);
+					if (it == projection.arrays.end())
+						continue;
+
+					auto &members = it->second.members;
+
+					std::unordered_set<std::string> memberVariables;
+					for (const auto &subrecord : arrayDesc.subrecords) {
+						collectExpressionVariables(subrecord.fields, memberVariables);
+					}
+
+					finishFieldMask(members, arrayDesc.memberLayout, memberVariables);
+
+					for (const auto &subrecord : arrayDesc.subrecords) {
+						if (std::none_of(subrecord.fields.begin(), subrecord.fields.end(), [&](const FieldDefinition &field) {
+							return members.decoded[arrayDesc.memberLayout.slot(field.name)];
+						})) {
+							projection.skippedSubrecords.insert(&subrecord);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void TESGameData::collectExpressionVariables(const std::vector<FieldDefinition> &fields, std::unordered_set<std::string> &variables) {
+		for (const auto &field : fields) {
+			for (auto element = &field; element; element = element->dataType.get()) {
+				for (const auto &token : element->length) {
+					if (auto variable = std::get_if<std::string>(&token)) {
+						variables.insert(*variable);
+					}
+				}
+			}
+		}
+	}
+
+	void TESGameData::finishFieldMask(FieldMask &mask, const TESStructLayout &layout, const std::unordered_set<std::string> &expressionVariables) {
+		mask.decoded = mask.selected;
+
+		for (const auto &variable : expressionVariables) {
+			if (auto slot = layout.tryGetSlot(variable)) {
+				mask.decoded[*slot] = true;
+			}
+		}
+
+		mask.hasUnselectedDecoded = false;
+		for (TESFieldSlot slot = 0; slot < layout.size(); slot++) {
+			if (mask.decoded[slot] && !mask.selected[slot]) {
+				mask.hasUnselectedDecoded = true;
+			}
+		}
+	}
+
+	void TESGameData::clearUnselectedFields(TESStruct &st, const FieldMask &mask) {
+		for (TESFieldSlot slot = 0; slot < st.fields.size(); slot++) {
+			if (!mask.selected[slot]) {
+				st.fields[slot] = std::monostate();
+			}
+		}
+	}
+
+	/*
+	 * Walks the record framing only, stepping over each record by its Size.
+	 * The header record is decoded immediately; every other known record that
+	 * passes the filter is added to m_index and gets an empty slot in
+	 * m_records. The remaining records are kept in m_skippedRecords, so that
+	 * save() can copy them.
+	 */
+	void TESGameData::indexRecords(const TESLoadOptions &options) {
+		auto begin = static_cast<const unsigned char *>(m_mapping->base());
+		auto end = begin + m_mapping->size();
 		InputSerializationStream stream(begin, end);
 
-		const auto &record = desc.getStructByName("Record");
-		const auto &subrecord = desc.getStructByName("Subrecord");
+		ExpressionEvaluator evaluator;
 
 		std::unordered_set<uint32_t> unknownRecords;
+		std::unordered_set<uint32_t> includeRecords(options.includeRecords.begin(), options.includeRecords.end());
+		std::unordered_set<uint32_t> excludeRecords(options.excludeRecords.begin(), options.excludeRecords.end());
 
 		bool headerExpected = true;
 
-		while (!stream.atEnd()) {
-			TESStruct recordData;
-			parseFields(stream, record.fields, recordData);
+		while (!stream.finished()) {
+			auto offset = stream.getCurrentPosition();
+
+			TESStruct recordData(m_recordLayout);
+			parseFields(stream, *m_recordProgram, recordData, nullptr, true, std::pmr::get_default_resource(), evaluator);
 
-			auto recordFourCC = recordData.value<TESUInt>("Name");
-			auto recordDesc = desc.tryGetRecordByFourCC(recordFourCC);
+			auto recordFourCC = recordData.value<TESUInt>(m_recordNameSlot);
+
+			auto skipRecord = [&]() {
+				auto position = headerExpected ? 0 : m_index.size() + 1;
+				m_skippedRecords.emplace_back(SkippedRecord{ position, RecordIndexEntry{ offset, stream.getCurrentPosition() - offset, nullptr, nullptr } });
+			};
+
+			if (!headerExpected && ((!includeRecords.empty() && includeRecords.count(recordFourCC) == 0) || excludeRecords.count(recordFourCC) != 0)) {
+				skipRecord();
+				continue;
+			}
+
+			auto recordDesc = m_description->tryGetRecordByFourCC(recordFourCC);
 			if (!recordDesc) {
 				if (unknownRecords.count(recordFourCC) == 0) {
 					fprintf(stderr, "unknown record: %s\n", fourCCToString(recordFourCC).c_str());
 					unknownRecords.insert(recordFourCC);
 				}
 
+				skipRecord();
 				continue;
 			}
 
+			auto projectionIt = m_projections.find(recordDesc);
+			auto projection = projectionIt == m_projections.end() ? nullptr : &projectionIt->second;
+
+			RecordIndexEntry entry{ offset, stream.getCurrentPosition() - offset, recordDesc, projection };
+
 			if (headerExpected) {
-				if (recordDesc->name != desc.headerRecord()) {
+				if (recordDesc->name != m_description->headerRecord()) {
 					std::stringstream error;
-					error << "Header (" << desc.headerRecord() << ") expected, got " << recordDesc->name;
+					error << "Header (" << m_description->headerRecord() << ") expected, got " << recordDesc->name;
 					throw std::runtime_error(error.str());
 				}
+
+				m_header = decodeRecord(entry, m_arenas.front().get());
+				m_headerEntry = entry;
+				headerExpected = false;
+			}
+			else {
+				m_index.emplace_back(entry);
+				m_records.emplace_back(recordDesc->name, nullptr);
+				m_modified.push_back(false);
+			}
+		}
+	}
+
+	/*
+	 * Records are split into contiguous chunks of roughly equal byte size, so
+	 * that a run of large CELL or LAND records and a run of tiny GMSTs cost
+	 * about the same. There are several chunks per thread, and threads pick
+	 * them up dynamically to absorb the remaining imbalance. Every record is
+	 * decoded straight into its own pre-sized slot of m_records, so the file
+	 * order is kept without any merging step. Each thread allocates from its
+	 * own arena, so threads never contend on the allocator.
+	 *
+	 * If decoding fails, the error of the earliest failing record is rethrown,
+	 * which is the same error serial decoding would have reported.
+	 */
+	void TESGameData::decodeRecordsParallel(unsigned int threads) {
+		static const size_t chunksPerThread = 8;
+
+		size_t totalSize = 0;
+		for (const auto &entry : m_index) {
+			totalSize += entry.size;
+		}
+
+		auto targetChunkSize = std::max<size_t>(1, totalSize / (threads * chunksPerThread));
+
+		std::vector<size_t> chunkStarts;
+		size_t chunkSize = 0;
+		for (size_t index = 0, count = m_index.size(); index < count; index++) {
+			if (chunkSize == 0) {
+				chunkStarts.push_back(index);
 			}
 
-			auto recordContents = std::make_unique<TESStruct>();
-			for (auto &&pair : recordData.fields) {
-				if (builtinRecordFields.count(pair.first) == 0) {
-					recordContents->fields.emplace(std::move(pair));
+			chunkSize += m_index[index].size;
+			if (chunkSize >= targetChunkSize) {
+				chunkSize = 0;
+			}
+		}
+		chunkStarts.push_back(m_index.size());
+
+		auto chunkCount = chunkStarts.size() - 1;
+		std::atomic<size_t> nextChunk(0);
+		std::atomic<bool> failed(false);
+		std::vector<std::exception_ptr> chunkErrors(chunkCount);
+
+		auto worker = [&](std::pmr::memory_resource *arena) {
+			size_t chunk;
+			while (!failed.load(std::memory_order_relaxed) && (chunk = nextChunk.fetch_add(1)) < chunkCount) {
+				try {
+					for (size_t index = chunkStarts[chunk]; index < chunkStarts[chunk + 1]; index++) {
+						m_records[index].second = decodeRecord(m_index[index], arena);
+					}
+				}
+				catch (...) {
+					chunkErrors[chunk] = std::current_exception();
+					failed.store(true, std::memory_order_relaxed);
 				}
 			}
-			
-			auto parsingPos = recordDesc->entries.begin();
-			std::vector<SubrecordDefinition>::const_iterator arrayParsingPos;
-			TESArray *buildingArray = nullptr;
-			TESStruct *buildingArrayMember = nullptr;
-			bool inArray = false;
+		};
 
-			const auto &recordDataBytes = recordData.value<std::vector<unsigned char>>("Data");
-			InputSerializationStream subrecordStream(recordDataBytes.data(), recordDataBytes.data() + recordDataBytes.size());
-			std::stringstream chain;
-			while (!subrecordStream.atEnd()) {
-				TESStruct subrecordData;
+		std::vector<std::thread> pool;
+		auto poolSize = std::min<size_t>(threads, chunkCount);
+		pool.reserve(poolSize - 1);
+		for (size_t thread = 1; thread < poolSize; thread++) {
+			pool.emplace_back(worker, createArena());
+		}
 
-				parseFields(subrecordStream, subrecord.fields, subrecordData);
+		worker(m_arenas.front().get());
 
-				auto subrecordFourcc = subrecordData.value<uint32_t>("Name");
+		for (auto &thread : pool) {
+			thread.join();
+		}
 
-				chain << fourCCToString(subrecordFourcc) << " ";
+		for (const auto &error : chunkErrors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+	}
 
-				const auto &subrecordDataBytes = subrecordData.value<std::vector<unsigned char>>("Data");
-				InputSerializationStream subrecordDataStream(subrecordDataBytes.data(), subrecordDataBytes.data() + subrecordDataBytes.size());
+	/*
+	 * If 'origin' is given, the data of every subrecord is collected into it
+	 * along with the decoded values, for save().
+	 */
+	const TESStruct *TESGameData::decodeRecord(const RecordIndexEntry &entry, std::pmr::memory_resource *arena, RecordOrigin *origin) const {
+		auto begin = static_cast<const unsigned char *>(m_mapping->base());
+		auto end = begin + m_mapping->size();
+		InputSerializationStream stream(begin, end);
+		stream.setCurrentPosition(entry.offset);
 
-				if (parsingPos == recordDesc->entries.end()) {
-					std::stringstream error;
-					error << recordDesc->name << ": EOF expected, got " << chain.str();
-					throw std::runtime_error(error.str());
-				}
+		auto recordDesc = entry.definition;
 
-				bool retryLookup;
-				do {
-					retryLookup = false;
+		ExpressionEvaluator evaluator;
 
-					auto currentArray = std::get_if<SubrecordArrayDefinition>(&*parsingPos);
-					if (currentArray && !inArray) {
-						arrayParsingPos = currentArray->subrecords.begin();
-						inArray = true;
-					}
+		TESStruct recordData(m_recordLayout);
+		parseFields(stream, *m_recordProgram, recordData, nullptr, true, std::pmr::get_default_resource(), evaluator);
 
-					bool found = false;
+		auto recordType = static_cast<uint32_t>(recordData.value<TESUInt>(m_recordNameSlot));
 
-					if (currentArray) {
-						for (auto it = arrayParsingPos; it != currentArray->subrecords.end(); ++it) {
-							const auto &subrecordDesc = *it;
-							if (subrecordDesc.fourcc == subrecordFourcc) {
-								arrayParsingPos = it;
-								found = true;
-								break;
-							}
-							else if (subrecordDesc.required) {
-								break;
-							}
+		/*
+		 * The record itself lives in the arena too, and is never destroyed.
+		 * Record layouts start with the fields of the Record structure, so
+		 * header fields keep their slots.
+		 */
+		std::pmr::polymorphic_allocator<TESStruct> allocator(arena);
+		auto recordContents = new(allocator.allocate(1)) TESStruct(&recordDesc->layout, arena);
+		for (auto slot : m_recordHeaderSlots) {
+			recordContents->fields[slot] = std::move(recordData.fields[slot]);
+		}
+		
+		const auto &stateMachine = recordDesc->stateMachine;
+		auto state = SubrecordStateMachine::InitialState;
+		TESArray *buildingArray = nullptr;
+		TESStruct *buildingArrayMember = nullptr;
 
-						}
+		auto projection = entry.projection;
+		const std::vector<bool> *recordDecodedFields = projection ? &projection->fields.decoded : nullptr;
+		const std::vector<bool> *memberDecodedFields = nullptr;
+		bool skipArray = false;
 
-						if (!found) {
-							if (inSet(subrecordFourcc, currentArray->leader)) {
-								for (auto it = arrayParsingPos; it != currentArray->subrecords.end(); ++it) {
-									const auto &subrecordDesc = *it;
+		const auto &recordDataBytes = recordData.value<TESByteArrayView>(m_recordDataSlot);
+		InputSerializationStream subrecordStream(recordDataBytes.data, recordDataBytes.data + recordDataBytes.size);
+		while (!subrecordStream.finished()) {
+			TESStruct subrecordData(m_subrecordLayout);
 
-									if (subrecordDesc.required) {
-										std::stringstream error;
-										error << recordDesc->name << ": unexpected subrecord (early array restart): " << chain.str() << ": expected " << fourCCToString(subrecordDesc.fourcc);
-										throw std::runtime_error(error.str());
-									}
-								}
+			parseFields(subrecordStream, *m_subrecordProgram, subrecordData, nullptr, true, std::pmr::get_default_resource(), evaluator);
 
-								buildingArrayMember = &std::get<TESStruct>(buildingArray->values.emplace_back(TESStruct()));
+			auto subrecordFourcc = subrecordData.value<uint32_t>(m_subrecordNameSlot);
 
-								arrayParsingPos = currentArray->subrecords.begin();
-							}
-						}
+			const auto &subrecordDataBytes = subrecordData.value<TESByteArrayView>(m_subrecordDataSlot);
+			InputSerializationStream subrecordDataStream(subrecordDataBytes.data, subrecordDataBytes.data + subrecordDataBytes.size);
+
+			auto transition = stateMachine.transition(state, subrecordFourcc);
+			if (!transition) {
+				auto chain = describeSubrecordChain(recordDataBytes.data, subrecordStream.getCurrentPosition());
+				throw std::runtime_error(stateMachine.describeError(*recordDesc, state, subrecordFourcc, chain));
+			}
+
+			auto skipSubrecord = projection && projection->skippedSubrecords.count(transition->subrecord) != 0;
+
+			if (transition->action == SubrecordAction::ArraySubrecord) {
+				if (transition->openArray) {
+					if (projection) {
+						auto it = projection->arrays.find(transition->array);
+						skipArray = it == projection->arrays.end();
+						memberDecodedFields = skipArray ? nullptr : &it->second.members.decoded;
 					}
 
-					if (!found) {
-						for (auto it = parsingPos; it != recordDesc->entries.end(); ++it) {
-							const auto &subrecordDesc = std::get_if<SubrecordDefinition>(&*it);
-							if (subrecordDesc) {
-								if (subrecordDesc->fourcc == subrecordFourcc) {
-									parsingPos = it;
-									found = true;
-									inArray = false;
-									currentArray = nullptr;
-									buildingArray = nullptr;
-									break;
-								}
-								else if (subrecordDesc->required) {
-									break;
-								}
-
-							}
-							else {
-								const auto &arrayDesc = std::get<SubrecordArrayDefinition>(*it);
-								
-								if (inSet(subrecordFourcc, arrayDesc.leader)) {
-									parsingPos = it;
-									found = true;
-									inArray = false;
-									currentArray = nullptr;
-									buildingArray = nullptr;
-									break;
-								}
-							}
+					if (!skipArray) {
+						auto &field = recordContents->fields[transition->arraySlot];
+						if (std::holds_alternative<std::monostate>(field)) {
+							field = TESArray(arena);
 						}
 
-						if (!found) {
-							std::stringstream error;
-							error << recordDesc->name << ": unexpected subrecord: " << chain.str() << ": expected";
-
-							bool walkOutsideArray = true;
-
-							if (currentArray) {
-								for (auto it = arrayParsingPos; it != currentArray->subrecords.end(); ++it) {
-									const auto &subrecordDesc = *it;
-									error << " " << fourCCToString(subrecordDesc.fourcc);
-
-									if (subrecordDesc.required) {
-										if(it != currentArray->subrecords.begin())
-											walkOutsideArray = false;
-
-										break;
-									}
-								}
-							}
-
-							if (walkOutsideArray) {
-								for (auto it = parsingPos; it != recordDesc->entries.end(); ++it) {
-									const auto &subrecordDesc = std::get_if<SubrecordDefinition>(&*it);
-									if (subrecordDesc) {
-										error << " " << fourCCToString(subrecordDesc->fourcc);
-
-										if (subrecordDesc->required)
-											break;
-									}
-									else {
-										const auto &arrayDesc = std::get<SubrecordArrayDefinition>(*it);
-
-										for (auto entry : arrayDesc.leader) {
-											error << " " << fourCCToString(entry);
-										}
-									}
-								}
-							}
-
-							throw std::runtime_error(error.str());
-						}
+						buildingArray = &std::get<TESArray>(field);
 					}
+				}
 
-					if (currentArray) {
-						const auto &subrecordDesc = *arrayParsingPos;
+				if (!skipArray) {
+					if (transition->pushMember) {
+						buildingArrayMember = &std::get<TESStruct>(buildingArray->values.emplace_back(TESStruct(&transition->array->memberLayout, arena)));
+					}
 
-						if (!buildingArray) {
-							auto result = recordContents->fields.emplace(currentArray->name, TESArray());
-							buildingArray = &std::get<TESArray>(result.first->second);
-						}
+					if (!skipSubrecord) {
+						parseSubrecord(subrecordDataStream, recordType, *transition->subrecord, *buildingArrayMember, memberDecodedFields, arena, evaluator);
+					}
 
-						if (!buildingArrayMember) {
-							buildingArrayMember = &std::get<TESStruct>(buildingArray->values.emplace_back(TESStruct()));
-						}
+					if (origin) {
+						origin->subrecords.emplace(std::make_pair(transition->subrecord, buildingArray->values.size() - 1), subrecordDataBytes);
+					}
+				}
+			}
+			else {
+				if (!skipSubrecord) {
+					parseSubrecord(subrecordDataStream, recordType, *transition->subrecord, *recordContents, recordDecodedFields, arena, evaluator);
+				}
 
-						parseFields(subrecordDataStream, subrecordDesc.fields, *buildingArrayMember);
+				if (origin) {
+					origin->subrecords.emplace(std::make_pair(transition->subrecord, RecordOrigin::NoMember), subrecordDataBytes);
+				}
+			}
 
-						++arrayParsingPos;
-					}
-					else {
-						auto subrecordDesc = std::get_if<SubrecordDefinition>(&*parsingPos);
-						if (subrecordDesc) {
-							parseFields(subrecordDataStream, subrecordDesc->fields, *recordContents);
+			state = transition->nextState;
+		}
 
-							++parsingPos;
-						}
-						else {
-							retryLookup = true;
-						}
+		if (projection) {
+			clearUnselectedFields(*recordContents, projection->fields);
+
+			for (const auto &pair : projection->arrays) {
+				const auto &array = pair.second;
+				if (!array.members.hasUnselectedDecoded)
+					continue;
+
+				if (auto values = std::get_if<TESArray>(&recordContents->fields[array.slot])) {
+					for (auto &member : values->values) {
+						clearUnselectedFields(std::get<TESStruct>(member), array.members);
 					}
-				} while (retryLookup);
+				}
 			}
+		}
 
-			if (headerExpected) {
-				m_header = std::move(recordContents);
-				headerExpected = false;
+		if (origin) {
+			origin->values = recordContents;
+		}
+
+		return recordContents;
+	}
+
+	/*
+	 * Lists the subrecords in the first 'size' bytes of a record's data, for
+	 * error messages. The chain is rebuilt by walking the subrecord headers
+	 * again only once decoding has failed, so that decoding itself doesn't
+	 * have to keep track of it.
+	 */
+	std::string TESGameData::describeSubrecordChain(const unsigned char *data, size_t size) const {
+		InputSerializationStream stream(data, data + size);
+		ExpressionEvaluator evaluator;
+		std::stringstream chain;
+
+		while (!stream.finished()) {
+			TESStruct subrecordData(m_subrecordLayout);
+
+			parseFields(stream, *m_subrecordProgram, subrecordData, nullptr, true, std::pmr::get_default_resource(), evaluator);
+
+			chain << fourCCToString(subrecordData.value<uint32_t>(m_subrecordNameSlot)) << " ";
+		}
+
+		return chain.str();
+	}
+
+	/*
+	 * Subrecords with a fixed layout are checked against its static size once
+	 * and then decoded without any further bounds checks. A subrecord of a
+	 * different size means that the description doesn't match the data: it is
+	 * recorded as layout drift and decoded with checks, which is how every
+	 * subrecord was decoded before, so it either fails the same way or leaves
+	 * its trailing bytes unread. Subrecords without fields don't describe
+	 * their contents, so they have no layout to drift from.
+	 */
+	void TESGameData::parseSubrecord(InputSerializationStream &stream, uint32_t recordType, const SubrecordDefinition &subrecord, TESStruct &record, const std::vector<bool> *decodedFields, std::pmr::memory_resource *arena, ExpressionEvaluator &evaluator) const {
+		auto fixedSize = subrecord.program.fixedSize;
+
+		if (fixedSize != DecodingInstruction::VariableSize && !subrecord.program.instructions.empty()) {
+			if (stream.remaining() == fixedSize) {
+				parseFields<false>(stream, subrecord.program, record, decodedFields, m_zeroCopy, arena, evaluator);
+				return;
 			}
-			else {
-				m_records.emplace_back(std::make_pair(recordDesc->name, std::move(recordContents)));
+
+			recordLayoutDrift(recordType, subrecord.fourcc, fixedSize, stream.remaining());
+		}
+
+		parseFields(stream, subrecord.program, record, decodedFields, m_zeroCopy, arena, evaluator);
+	}
+
+	void TESGameData::recordLayoutDrift(uint32_t recordType, uint32_t subrecordType, size_t expectedSize, size_t actualSize) const {
+		std::unique_lock<std::mutex> lock(m_layoutDriftMutex);
+
+		for (auto &drift : m_layoutDrift) {
+			if (drift.recordType == recordType && drift.subrecordType == subrecordType && drift.actualSize == actualSize) {
+				drift.count++;
+				return;
 			}
 		}
+
+		m_layoutDrift.emplace_back(TESLayoutDrift{ recordType, subrecordType, expectedSize, actualSize, 1 });
 	}
 
-	void TESGameData::parseFields(SerializationStream &stream, const std::vector<FieldDefinition> &fields, TESStruct &record) {
-		for (const auto &field : fields) {
-			record.fields.emplace(field.name, parseFieldValue(stream, field, record));
+	std::vector<TESLayoutDrift> TESGameData::layoutDrift() const {
+		std::vector<TESLayoutDrift> drift;
+
+		{
+			std::unique_lock<std::mutex> lock(m_layoutDriftMutex);
+			drift = m_layoutDrift;
+		}
+
+		std::sort(drift.begin(), drift.end(), [](const TESLayoutDrift &a, const TESLayoutDrift &b) {
+			return std::tie(a.recordType, a.subrecordType, a.actualSize) < std::tie(b.recordType, b.subrecordType, b.actualSize);
+		});
+
+		return drift;
+	}
+
+	const TESStruct &TESGameData::record(size_t index) const {
+		auto &entry = m_records.at(index);
+		if (!entry.second) {
+			entry.second = decodeRecord(m_index[index], m_arenas.front().get());
+		}
+
+		return *entry.second;
+	}
+
+	/*
+	 * Records are allocated as non-const objects in the arena, so handing out
+	 * mutable references to them is safe.
+	 */
+	TESStruct &TESGameData::modifyRecord(size_t index) {
+		auto &record = const_cast<TESStruct &>(this->record(index));
+
+		if (m_index[index].projection)
+			throw std::logic_error("records loaded with a field projection can't be modified");
+
+		m_modified[index] = true;
+
+		return record;
+	}
+
+	TESStruct &TESGameData::modifyHeader() {
+		if (!m_header)
+			throw std::logic_error("no data is loaded");
+
+		if (m_headerEntry.projection)
+			throw std::logic_error("records loaded with a field projection can't be modified");
+
+		m_headerModified = true;
+
+		return const_cast<TESStruct &>(*m_header);
+	}
+
+	std::pmr::memory_resource *TESGameData::memoryResource() const {
+		if (m_arenas.empty())
+			throw std::logic_error("no data is loaded");
+
+		return m_arenas.front().get();
+	}
+
+	const std::vector<std::pair<std::string, const TESStruct *>> &TESGameData::records() const {
+		for (size_t index = 0, count = m_records.size(); index < count; index++) {
+			record(index);
+		}
+
+		return m_records;
+	}
+
+	/*
+	 * With referenceSource set, ByteArray and String values are returned as
+	 * views into the stream's memory instead of copies. This is always the case
+	 * for the record and subrecord framing, whose Data is only needed while the
+	 * record is being decoded.
+	 */
+	template<bool Checked>
+	void TESGameData::parseFields(InputSerializationStream &stream, const DecodingProgram &program, TESStruct &record, const std::vector<bool> *decodedFields, bool referenceSource, std::pmr::memory_resource *arena, ExpressionEvaluator &evaluator) const {
+		const auto *instruction = program.instructions.data();
+		const auto *end = instruction + program.instructions.size();
+
+		while (instruction != end) {
+			// Fields that are not decoded are still stepped over, as later fields follow them
+			if (decodedFields && !(*decodedFields)[instruction->slot]) {
+				skipFieldValue<Checked>(stream, instruction, record, evaluator);
+
+				instruction += instruction->span;
+				continue;
+			}
+
+			auto value = parseFieldValue<Checked>(stream, instruction, record, referenceSource, arena, evaluator);
+
+			// As with a duplicate key, the first value of a repeated field name wins
+			auto &field = record.fields[instruction->slot];
+			if (std::holds_alternative<std::monostate>(field)) {
+				field = std::move(value);
+			}
+
+			instruction += instruction->span;
+		}
+	}
+
+	ExpressionInteger TESGameData::evaluateLength(InputSerializationStream &stream, const DecodingInstruction *instruction, const TESStruct &context, ExpressionEvaluator &evaluator) const {
+		switch (instruction->lengthSource) {
+		case LengthSource::Constant:
+			return instruction->constantLength;
+
+		case LengthSource::Expression:
+			return evaluator.evaluate(*instruction->lengthExpression, context);
+
+		default:
+			return static_cast<ExpressionInteger>(stream.remaining());
 		}
 	}
 
-	TESValue TESGameData::parseFieldValue(SerializationStream &stream, const FieldDefinition &field, const TESStruct &context) {
-		switch (field.type) {
-		case FieldType::FourCC:
-		case FieldType::UInt32:
+	template<bool Checked>
+	TESValue TESGameData::parseFieldValue(InputSerializationStream &stream, const DecodingInstruction *instruction, const TESStruct &context, bool referenceSource, std::pmr::memory_resource *arena, ExpressionEvaluator &evaluator) const {
+		switch (instruction->opcode) {
+		case DecodingOpcode::UInt32:
 		{
-			uint32_t val;
-			stream >> val;
+			auto val = stream.read<uint32_t, Checked>();
 			return static_cast<TESUInt>(val);
-		}	
+		}
 
-		case FieldType::Int8:
+		case DecodingOpcode::Int8:
 		{
-			int8_t val;
-			stream >> val;
+			auto val = stream.read<int8_t, Checked>();
 			return static_cast<TESInt>(val);
 		}
 
-		case FieldType::UInt8:
+		case DecodingOpcode::UInt8:
 		{
-			uint8_t val;
-			stream >> val;
+			auto val = stream.read<uint8_t, Checked>();
 			return static_cast<TESUInt>(val);
 		}
 
-		case FieldType::UInt16:
+		case DecodingOpcode::UInt16:
 		{
-			uint16_t val;
-			stream >> val;
+			auto val = stream.read<uint16_t, Checked>();
 			return static_cast<TESUInt>(val);
 		}
 
-		case FieldType::Int32:
+		case DecodingOpcode::Int32:
 		{
-			int32_t val;
-			stream >> val;
+			auto val = stream.read<int32_t, Checked>();
 			return static_cast<TESInt>(val);
 		}
 
-		case FieldType::Float:
+		case DecodingOpcode::Float:
 		{
-			float val;
-			stream >> val;
+			auto val = stream.read<float, Checked>();
 			return val;
 		}
 
-		case FieldType::ByteArray:
+		case DecodingOpcode::ByteArray:
 		{
-			ExpressionEvaluator evaluator;
-			ExpressionInteger length;
-			if (field.length.empty()) {
-				length = stream.remainingSize();
-			}
-			else {
-				length = evaluator.evaluate(field.length, context);
+			auto length = evaluateLength(stream, instruction, context, evaluator);
+			if (length < 0)
+				throw std::runtime_error("negative ByteArray length");
+
+			auto region = stream.readRegion<Checked>(length);
+			if (referenceSource) {
+				return TESByteArrayView{ region, static_cast<size_t>(length) };
 			}
-			std::vector<unsigned char> data(length);
-			stream >> data;
-			return data;
+
+			return std::pmr::vector<unsigned char>(region, region + length, arena);
 		}
 
-		case FieldType::String:
+		case DecodingOpcode::String:
 		{
-			ExpressionEvaluator evaluator;
-			ExpressionInteger length;
-			if (field.length.empty()) {
-				length = stream.remainingSize();
-			}
-			else {
-				length = evaluator.evaluate(field.length, context);
-			}
+			auto length = evaluateLength(stream, instruction, context, evaluator);
+			if (length < 0)
+				throw std::runtime_error("negative String length");
 
-			std::vector<char> data(length);
-			stream >> data;
+			auto region = reinterpret_cast<const char *>(stream.readRegion<Checked>(length));
+			auto terminator = std::find(region, region + length, 0);
 
-			auto terminator = std::find(data.begin(), data.end(), 0);
-			
-			return std::string(data.begin(), terminator);
+			if (referenceSource) {
+				return std::string_view(region, terminator - region);
+			}
+
+			return std::pmr::string(region, terminator, arena);
 		}
 
-		case FieldType::Array:
+		case DecodingOpcode::Array:
 		{
-			TESArray data;
+			auto element = instruction + 1;
+
+			switch (element->opcode) {
+			case DecodingOpcode::UInt32:
+			case DecodingOpcode::Int8:
+			case DecodingOpcode::UInt8:
+			case DecodingOpcode::UInt16:
+			case DecodingOpcode::Int32:
+			case DecodingOpcode::Float:
+			{
+				/*
+				 * A trailing partial element is still requested, so that it
+				 * fails the same way as reading element by element would.
+				 */
+				size_t count;
+				if (instruction->lengthSource == LengthSource::Remaining) {
+					count = (stream.remaining() + element->fixedSize - 1) / element->fixedSize;
+				}
+				else {
+					auto length = evaluateLength(stream, instruction, context, evaluator);
+					if (length < 0)
+						throw std::runtime_error("negative Array length");
+
+					count = static_cast<size_t>(length);
+				}
+
+				switch (element->opcode) {
+				case DecodingOpcode::UInt32:
+					return parseTypedArray<uint32_t, Checked>(stream, count, arena);
 
-			ExpressionEvaluator evaluator;
-			if (field.length.empty()) {
-				while (!stream.atEnd()) {
-					auto value = parseFieldValue(stream, *field.dataType, context);
+				case DecodingOpcode::Int8:
+					return parseTypedArray<int8_t, Checked>(stream, count, arena);
+
+				case DecodingOpcode::UInt8:
+					return parseTypedArray<uint8_t, Checked>(stream, count, arena);
+
+				case DecodingOpcode::UInt16:
+					return parseTypedArray<uint16_t, Checked>(stream, count, arena);
+
+				case DecodingOpcode::Int32:
+					return parseTypedArray<int32_t, Checked>(stream, count, arena);
+
+				default:
+					return parseTypedArray<float, Checked>(stream, count, arena);
+				}
+			}
+
+			default:
+				break;
+			}
+
+			TESArray data(arena);
+
+			if (instruction->lengthSource == LengthSource::Remaining) {
+				while (!stream.finished()) {
+					auto value = parseFieldValue<Checked>(stream, element, context, referenceSource, arena, evaluator);
 					data.values.emplace_back(std::move(value));
 				}
 			}
 			else {
-				auto length = evaluator.evaluate(field.length, context);
-				data.values.resize(length);
+				auto length = evaluateLength(stream, instruction, context, evaluator);
+				if (length < 0)
+					throw std::runtime_error("negative Array length");
+
+				/*
+				 * As for typed arrays, a length that the remaining data can't
+				 * hold fails before anything is allocated. Elements of
+				 * variable size may be empty, so they are only allocated as
+				 * they are read.
+				 */
+				auto count = static_cast<size_t>(length);
+				if (element->fixedSize != DecodingInstruction::VariableSize && element->fixedSize != 0) {
+					if (Checked && count > stream.remaining() / element->fixedSize)
+						throw std::logic_error("read is out of bounds");
+
+					data.values.reserve(count);
+				}
 
-				for (auto &entry : data.values) {
-					entry = parseFieldValue(stream, *field.dataType, context);
+				for (size_t index = 0; index < count; index++) {
+					data.values.emplace_back(parseFieldValue<Checked>(stream, element, context, referenceSource, arena, evaluator));
 				}
 			}
 
 			return data;
 		}
 
-		case FieldType::StructRef:
+		case DecodingOpcode::Struct:
 		{
-			const auto &structDef = m_description->getStructByName(field.structName);
-			TESStruct st;
+			TESStruct st(instruction->structLayout, arena);
 
-			parseFields(stream, structDef.fields, st);
+			parseFields<Checked>(stream, *instruction->structProgram, st, nullptr, referenceSource, arena, evaluator);
 			
 			return st;
 		}
@@ -374,9 +857,113 @@ namespace tesparse {
 		default:
 		{
 			std::stringstream error;
-			error << "Unsupported field type: " << static_cast<unsigned int>(field.type);
+			error << "Unsupported opcode: " << static_cast<unsigned int>(instruction->opcode);
 			throw std::runtime_error(error.str());
 		}
 		}
 	}
+
+	/*
+	 * Steps over a field the way parseFieldValue would read it, failing the
+	 * same way on malformed data, but without materializing its value. Only
+	 * structures of variable size are still parsed, into a temporary, as the
+	 * lengths of their fields may depend on earlier fields.
+	 */
+	template<bool Checked>
+	void TESGameData::skipFieldValue(InputSerializationStream &stream, const DecodingInstruction *instruction, const TESStruct &context, ExpressionEvaluator &evaluator) const {
+		if (instruction->fixedSize != DecodingInstruction::VariableSize) {
+			stream.readRegion<Checked>(instruction->fixedSize);
+			return;
+		}
+
+		switch (instruction->opcode) {
+		case DecodingOpcode::ByteArray:
+		case DecodingOpcode::String:
+		{
+			auto length = evaluateLength(stream, instruction, context, evaluator);
+			if (length < 0)
+				throw std::runtime_error(instruction->opcode == DecodingOpcode::ByteArray ? "negative ByteArray length" : "negative String length");
+
+			stream.readRegion<Checked>(static_cast<size_t>(length));
+			break;
+		}
+
+		case DecodingOpcode::Array:
+		{
+			auto element = instruction + 1;
+			auto elementSize = element->fixedSize;
+
+			if (instruction->lengthSource == LengthSource::Remaining) {
+				if (elementSize != DecodingInstruction::VariableSize && elementSize != 0) {
+					// A trailing partial element fails as in parseFieldValue
+					auto count = (stream.remaining() + elementSize - 1) / elementSize;
+					stream.readRegion<Checked>(count * elementSize);
+				}
+				else {
+					while (!stream.finished()) {
+						skipFieldValue<Checked>(stream, element, context, evaluator);
+					}
+				}
+
+				break;
+			}
+
+			auto length = evaluateLength(stream, instruction, context, evaluator);
+			if (length < 0)
+				throw std::runtime_error("negative Array length");
+
+			auto count = static_cast<size_t>(length);
+			if (elementSize != DecodingInstruction::VariableSize && elementSize != 0) {
+				if (Checked && count > stream.remaining() / elementSize)
+					throw std::logic_error("read is out of bounds");
+
+				stream.readRegion<Checked>(count * elementSize);
+			}
+			else {
+				for (size_t index = 0; index < count; index++) {
+					skipFieldValue<Checked>(stream, element, context, evaluator);
+				}
+			}
+
+			break;
+		}
+
+		case DecodingOpcode::Struct:
+		{
+			TESStruct st(instruction->structLayout);
+
+			parseFields<Checked>(stream, *instruction->structProgram, st, nullptr, true, std::pmr::get_default_resource(), evaluator);
+			break;
+		}
+
+		default:
+			parseFieldValue<Checked>(stream, instruction, context, true, std::pmr::get_default_resource(), evaluator);
+			break;
+		}
+	}
+
+	template<typename T, bool Checked>
+	TESValue TESGameData::parseTypedArray(InputSerializationStream &stream, size_t count, std::pmr::memory_resource *arena) {
+		TESTypedArray<T> data(arena);
+
+		if (Checked && count > stream.remaining() / sizeof(T)) {
+			throw std::logic_error("read is out of bounds");
+		}
+
+		data.values.resize(count);
+
+		auto region = stream.readRegion<Checked>(count * sizeof(T));
+		auto values = reinterpret_cast<unsigned char *>(data.values.data());
+
+		if (stream.swapEndian()) {
+			for (size_t offset = 0; offset < count * sizeof(T); offset += sizeof(T)) {
+				std::reverse_copy(region + offset, region + offset + sizeof(T), values + offset);
+			}
+		}
+		else if (count != 0) {
+			memcpy(values, region, count * sizeof(T));
+		}
+
+		return data;
+	}
 }
@@ -0,0 +1,330 @@
+#include <tesparse/TESGameData.h>
+#include <tesparse/FileMapping.h>
+#include <tesparse/InputSerializationStream.h>
+#include <tesparse/OutputSerializationStream.h>
+#include <tesparse/TESFileFormatDescription.h>
+#include <tesparse/ExpressionEvaluator.h>
+
+#include <cstring>
+#include <sstream>
+
+/*
+ * In-place patching of fixed-size fields. A field is found by walking the
+ * record's subrecord headers through the subrecord state machine, without
+ * decoding any fields, and its offset within the subrecord is computed from
+ * the sizes of the fields before it in the decoding program.
+ */
+
+namespace tesparse {
+	struct FieldPathSegment {
+		std::string name;
+		bool indexed;
+		size_t index;
+	};
+
+	[[noreturn]] static void fieldPathError(const std::string_view &path, const std::string &message) {
+		std::stringstream error;
+		error << "Field path " << path << ": " << message;
+		throw std::runtime_error(error.str());
+	}
+
+	static std::vector<FieldPathSegment> parseFieldPath(const std::string_view &path) {
+		std::vector<FieldPathSegment> segments;
+
+		size_t position = 0;
+		for (;;) {
+			auto end = path.find_first_of(".[", position);
+			if (end == std::string_view::npos)
+				end = path.size();
+
+			if (end == position)
+				fieldPathError(path, "expected a field name");
+
+			auto &segment = segments.emplace_back(FieldPathSegment{ std::string(path.substr(position, end - position)), false, 0 });
+			position = end;
+
+			if (position < path.size() && path[position] == '[') {
+				auto close = path.find(']', position);
+				if (close == std::string_view::npos || close == position + 1)
+					fieldPathError(path, "expected an index");
+
+				segment.indexed = true;
+				for (auto ch : path.substr(position + 1, close - position - 1)) {
+					if (ch < '0' || ch > '9')
+						fieldPathError(path, "expected an index");
+
+					segment.index = segment.index * 10 + (ch - '0');
+				}
+
+				position = close + 1;
+			}
+
+			if (position == path.size())
+				break;
+
+			if (path[position] != '.')
+				fieldPathError(path, "expected '.' or '['");
+
+			position++;
+		}
+
+		return segments;
+	}
+
+	/*
+	 * Finds the field in the slot among the top-level fields of a program, and
+	 * adds its offset to 'offset'. Returns nullptr if the program doesn't
+	 * have the field.
+	 */
+	static const DecodingInstruction *findField(const DecodingProgram &program, TESFieldSlot slot, size_t &offset, const std::string_view &path) {
+		const auto *instruction = program.instructions.data();
+		const auto *end = instruction + program.instructions.size();
+
+		size_t fieldOffset = 0;
+		bool fixedOffset = true;
+
+		for (; instruction != end; instruction += instruction->span) {
+			if (instruction->slot == slot) {
+				if (!fixedOffset)
+					fieldPathError(path, "the offset of the field depends on variable-size fields");
+
+				offset += fieldOffset;
+				return instruction;
+			}
+
+			if (instruction->fixedSize == DecodingInstruction::VariableSize)
+				fixedOffset = false;
+			else
+				fieldOffset += instruction->fixedSize;
+		}
+
+		return nullptr;
+	}
+
+	/*
+	 * Returns the instruction of the field the path refers to, and sets
+	 * 'offset' to the field's offset in the file.
+	 */
+	const DecodingInstruction *TESGameData::resolveFieldPath(const RecordIndexEntry &entry, const std::string_view &path, size_t &offset) const {
+		auto segments = parseFieldPath(path);
+
+		if (!m_mapping)
+			throw std::logic_error("the source file is no longer mapped");
+
+		const auto &recordDesc = *entry.definition;
+
+		auto base = static_cast<const unsigned char *>(m_mapping->base());
+		InputSerializationStream stream(base, base + m_mapping->size());
+		stream.setCurrentPosition(entry.offset);
+
+		ExpressionEvaluator evaluator;
+
+		TESStruct recordData(m_recordLayout);
+		parseFields(stream, *m_recordProgram, recordData, nullptr, true, std::pmr::get_default_resource(), evaluator);
+
+		const auto &recordDataBytes = recordData.value<TESByteArrayView>(m_recordDataSlot);
+
+		auto segment = segments.cbegin();
+		const DecodingInstruction *instruction = nullptr;
+		size_t regionEnd; // end of the record header or of the subrecord's data
+
+		offset = 0;
+
+		/*
+		 * Record contents reuse the slots of Name, Size and Data for fields of
+		 * subrecords, so those names refer to subrecord fields.
+		 */
+		auto headerSlot = m_recordLayout->tryGetSlot(segment->name);
+		if (headerSlot && (*headerSlot == m_recordNameSlot || *headerSlot == m_recordSizeSlot || *headerSlot == m_recordDataSlot))
+			headerSlot = nullptr;
+
+		if (headerSlot) {
+			instruction = findField(*m_recordProgram, *headerSlot, offset, path);
+			offset += entry.offset;
+			regionEnd = recordDataBytes.data - base;
+		}
+		else {
+			const SubrecordArrayDefinition *array = nullptr;
+			for (const auto &recordEntry : recordDesc.entries) {
+				auto candidate = std::get_if<SubrecordArrayDefinition>(&recordEntry);
+				if (candidate && candidate->name == segment->name) {
+					array = candidate;
+					break;
+				}
+			}
+
+			/*
+			 * The index of an array segment selects the member, so the walk
+			 * below continues with the member field, whose own index, if
+			 * any, still has to be applied.
+			 */
+			const TESFieldSlot *slot;
+			if (array) {
+				if (!segment->indexed || ++segment == segments.cend())
+					fieldPathError(path, "a field of a subrecord array member is expected");
+
+				slot = array->memberLayout.tryGetSlot(segment->name);
+			}
+			else {
+				slot = recordDesc.layout.tryGetSlot(segment->name);
+			}
+
+			if (!slot)
+				fieldPathError(path, "undefined field " + segment->name);
+
+			/*
+			 * The subrecord that holds the field is the first one of a
+			 * definition with the field, as the decoder keeps the first value
+			 * of a field.
+			 */
+			const auto &stateMachine = recordDesc.stateMachine;
+			auto state = SubrecordStateMachine::InitialState;
+			size_t members = 0;
+
+			InputSerializationStream subrecordStream(recordDataBytes.data, recordDataBytes.data + recordDataBytes.size);
+			while (!subrecordStream.finished()) {
+				TESStruct subrecordData(m_subrecordLayout);
+				parseFields(subrecordStream, *m_subrecordProgram, subrecordData, nullptr, true, std::pmr::get_default_resource(), evaluator);
+
+				auto subrecordFourcc = subrecordData.value<uint32_t>(m_subrecordNameSlot);
+
+				auto transition = stateMachine.transition(state, subrecordFourcc);
+				if (!transition) {
+					auto chain = describeSubrecordChain(recordDataBytes.data, subrecordStream.getCurrentPosition());
+					throw std::runtime_error(stateMachine.describeError(recordDesc, state, subrecordFourcc, chain));
+				}
+
+				bool candidate;
+				if (array) {
+					if (transition->action == SubrecordAction::ArraySubrecord && transition->array == array && transition->pushMember)
+						members++;
+
+					candidate = transition->action == SubrecordAction::ArraySubrecord && transition->array == array && members == segments.front().index + 1;
+				}
+				else {
+					candidate = transition->action == SubrecordAction::Subrecord;
+				}
+
+				if (candidate) {
+					const auto &program = transition->subrecord->program;
+					const auto &subrecordDataBytes = subrecordData.value<TESByteArrayView>(m_subrecordDataSlot);
+
+					instruction = findField(program, *slot, offset, path);
+					if (instruction) {
+						if (program.fixedSize != DecodingInstruction::VariableSize && program.fixedSize != subrecordDataBytes.size)
+							fieldPathError(path, "the size of the subrecord doesn't match its layout");
+
+						offset += subrecordDataBytes.data - base;
+						regionEnd = subrecordDataBytes.data + subrecordDataBytes.size - base;
+						break;
+					}
+				}
+
+				state = transition->nextState;
+			}
+
+			if (!instruction)
+				fieldPathError(path, "the field is not present in the record");
+		}
+
+		for (;;) {
+			if (segment->indexed) {
+				if (instruction->opcode != DecodingOpcode::Array)
+					fieldPathError(path, segment->name + " is not an array");
+
+				auto element = instruction + 1;
+				if (instruction->lengthSource != LengthSource::Constant || element->fixedSize == DecodingInstruction::VariableSize)
+					fieldPathError(path, "the size of " + segment->name + " isn't fixed");
+
+				if (segment->index >= static_cast<size_t>(instruction->constantLength))
+					fieldPathError(path, "index is out of range");
+
+				offset += segment->index * element->fixedSize;
+				instruction = element;
+			}
+
+			if (++segment == segments.cend())
+				break;
+
+			if (instruction->opcode != DecodingOpcode::Struct)
+				fieldPathError(path, "field is not a structure");
+
+			auto slot = instruction->structLayout->tryGetSlot(segment->name);
+			auto field = slot ? findField(*instruction->structProgram, *slot, offset, path) : nullptr;
+			if (!field)
+				fieldPathError(path, "undefined field " + segment->name);
+
+			instruction = field;
+		}
+
+		if (instruction->fixedSize == DecodingInstruction::VariableSize)
+			fieldPathError(path, "the size of the field isn't fixed");
+
+		if (offset + instruction->fixedSize > regionEnd)
+			fieldPathError(path, "the field lies outside of its subrecord");
+
+		return instruction;
+	}
+
+	TESFieldLocation TESGameData::locateField(size_t index, const std::string_view &path) const {
+		size_t offset;
+		auto instruction = resolveFieldPath(m_index.at(index), path, offset);
+
+		return TESFieldLocation{ offset, instruction->fixedSize };
+	}
+
+	TESFieldLocation TESGameData::locateHeaderField(const std::string_view &path) const {
+		if (!m_header)
+			throw std::logic_error("no data is loaded");
+
+		size_t offset;
+		auto instruction = resolveFieldPath(m_headerEntry, path, offset);
+
+		return TESFieldLocation{ offset, instruction->fixedSize };
+	}
+
+	void TESGameData::patchField(size_t index, const std::string_view &path, const TESValue &value) {
+		patchRecordField(m_index.at(index), path, value);
+	}
+
+	void TESGameData::patchHeaderField(const std::string_view &path, const TESValue &value) {
+		if (!m_header)
+			throw std::logic_error("no data is loaded");
+
+		patchRecordField(m_headerEntry, path, value);
+	}
+
+	/*
+	 * The value is encoded into a buffer first, so that a value that can't be
+	 * encoded leaves the file untouched.
+	 */
+	void TESGameData::patchRecordField(const RecordIndexEntry &entry, const std::string_view &path, const TESValue &value) {
+		size_t offset;
+		auto instruction = resolveFieldPath(entry, path, offset);
+
+		auto target = static_cast<unsigned char *>(m_mapping->writableBase()) + offset;
+
+		OutputSerializationStream stream;
+		ExpressionEvaluator evaluator;
+		TESStruct context;
+
+		try {
+			encodeFieldValue(&stream, instruction, value, context, evaluator);
+		}
+		catch (const std::exception &e) {
+			fieldPathError(path, e.what());
+		}
+
+		if (stream.getCurrentPosition() != instruction->fixedSize)
+			throw std::logic_error("encoded value doesn't match the size of the field");
+
+		auto data = stream.data();
+		memcpy(target, data.data(), data.size());
+	}
+
+	void TESGameData::flush() {
+		if (m_mapping) {
+			m_mapping->flush();
+		}
+	}
+}
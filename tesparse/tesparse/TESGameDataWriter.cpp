@@ -0,0 +1,670 @@
+#include <tesparse/TESGameData.h>
+#include <tesparse/FileMapping.h>
+#include <tesparse/OutputSerializationStream.h>
+#include <tesparse/TESFileFormatDescription.h>
+#include <tesparse/ExpressionEvaluator.h>
+#include <tesparse/FourCC.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <sstream>
+
+/*
+ * Encoding of records back into the file format. Every encode function
+ * takes an optional stream and returns the number of bytes the value takes
+ * up: without a stream, only the size is computed. Sizes of a record and of
+ * each of its subrecords are computed before their framing is written, so
+ * nothing has to be patched afterwards.
+ */
+
+namespace tesparse {
+	template<typename T>
+	struct IsTypedArray : std::false_type {};
+
+	template<typename T>
+	struct IsTypedArray<TESTypedArray<T>> : std::true_type {};
+
+	// Opcode of the element instruction that decodes into TESTypedArray<T>
+	static DecodingOpcode typedArrayOpcode(const TESTypedArray<uint32_t> &) { return DecodingOpcode::UInt32; }
+	static DecodingOpcode typedArrayOpcode(const TESTypedArray<int8_t> &) { return DecodingOpcode::Int8; }
+	static DecodingOpcode typedArrayOpcode(const TESTypedArray<uint8_t> &) { return DecodingOpcode::UInt8; }
+	static DecodingOpcode typedArrayOpcode(const TESTypedArray<uint16_t> &) { return DecodingOpcode::UInt16; }
+	static DecodingOpcode typedArrayOpcode(const TESTypedArray<int32_t> &) { return DecodingOpcode::Int32; }
+	static DecodingOpcode typedArrayOpcode(const TESTypedArray<float> &) { return DecodingOpcode::Float; }
+
+	// T is the encoded type, V the TESValue alternative that holds it
+	template<typename T, typename V>
+	static size_t encodeScalar(SerializationStream *stream, const TESValue &value, const char *typeName) {
+		auto val = std::get_if<V>(&value);
+		if (!val) {
+			std::stringstream error;
+			error << "expected a value of type " << typeName;
+			throw std::runtime_error(error.str());
+		}
+
+		if constexpr (!std::is_same<T, V>::value) {
+			if (*val < static_cast<V>(std::numeric_limits<T>::lowest()) || *val > static_cast<V>(std::numeric_limits<T>::max())) {
+				std::stringstream error;
+				error << "value " << *val << " is out of range for " << typeName;
+				throw std::runtime_error(error.str());
+			}
+		}
+
+		if (stream) {
+			*stream << static_cast<T>(*val);
+		}
+
+		return sizeof(T);
+	}
+
+	/*
+	 * Length of a ByteArray, String or Array field as the decoder would
+	 * compute it, or VariableSize if the field extends to the end of its
+	 * data.
+	 */
+	static size_t encodedLength(const DecodingInstruction *instruction, const TESStruct &context, ExpressionEvaluator &evaluator) {
+		switch (instruction->lengthSource) {
+		case LengthSource::Constant:
+			return static_cast<size_t>(instruction->constantLength);
+
+		case LengthSource::Expression:
+		{
+			auto length = evaluator.evaluate(*instruction->lengthExpression, context);
+			if (length < 0)
+				throw std::runtime_error("negative length");
+
+			return static_cast<size_t>(length);
+		}
+
+		default:
+			return DecodingInstruction::VariableSize;
+		}
+	}
+
+	static std::string_view bytesOf(const TESValue &value) {
+		if (auto bytes = std::get_if<std::pmr::vector<unsigned char>>(&value))
+			return std::string_view(reinterpret_cast<const char *>(bytes->data()), bytes->size());
+
+		const auto &view = std::get<TESByteArrayView>(value);
+		return std::string_view(reinterpret_cast<const char *>(view.data), view.size);
+	}
+
+	static std::string_view textOf(const TESValue &value) {
+		if (auto owned = std::get_if<std::pmr::string>(&value))
+			return *owned;
+
+		return std::get<std::string_view>(value);
+	}
+
+	/*
+	 * Whether two values would encode the same. Owned and referencing forms
+	 * of byte arrays and strings compare by contents, and floats compare by
+	 * representation.
+	 */
+	static bool sameValue(const TESValue &left, const TESValue &right) {
+		auto isBytes = [](const TESValue &value) {
+			return std::holds_alternative<std::pmr::vector<unsigned char>>(value) || std::holds_alternative<TESByteArrayView>(value);
+		};
+
+		auto isText = [](const TESValue &value) {
+			return std::holds_alternative<std::pmr::string>(value) || std::holds_alternative<std::string_view>(value);
+		};
+
+		if (isBytes(left) && isBytes(right))
+			return bytesOf(left) == bytesOf(right);
+
+		if (isText(left) && isText(right))
+			return textOf(left) == textOf(right);
+
+		if (left.index() != right.index())
+			return false;
+
+		return std::visit([&](const auto &leftValue) -> bool {
+			using ValueType = std::decay_t<decltype(leftValue)>;
+			const auto &rightValue = std::get<ValueType>(right);
+
+			if constexpr (std::is_same<ValueType, std::monostate>::value) {
+				return true;
+			}
+			else if constexpr (std::is_same<ValueType, float>::value) {
+				return memcmp(&leftValue, &rightValue, sizeof(float)) == 0;
+			}
+			else if constexpr (std::is_same<ValueType, TESStruct>::value) {
+				return leftValue.layout == rightValue.layout && std::equal(leftValue.fields.begin(), leftValue.fields.end(), rightValue.fields.begin(), rightValue.fields.end(), sameValue);
+			}
+			else if constexpr (std::is_same<ValueType, TESArray>::value) {
+				return std::equal(leftValue.values.begin(), leftValue.values.end(), rightValue.values.begin(), rightValue.values.end(), sameValue);
+			}
+			else if constexpr (IsTypedArray<ValueType>::value) {
+				return leftValue.values.size() == rightValue.values.size() &&
+					memcmp(leftValue.values.data(), rightValue.values.data(), leftValue.values.size() * sizeof(leftValue.values[0])) == 0;
+			}
+			else if constexpr (std::is_same<ValueType, TESUInt>::value || std::is_same<ValueType, TESInt>::value) {
+				return leftValue == rightValue;
+			}
+			else {
+				// Byte arrays and strings were compared above
+				return false;
+			}
+		}, left);
+	}
+
+	static void checkLength(size_t expected, size_t actual) {
+		if (expected != DecodingInstruction::VariableSize && expected != actual) {
+			std::stringstream error;
+			error << "length is " << actual << ", but the description requires " << expected;
+			throw std::runtime_error(error.str());
+		}
+	}
+
+	void TESGameData::save(const std::string_view &filename) const {
+		if (!m_header)
+			throw std::logic_error("no data is loaded");
+
+		if (!m_mapping)
+			throw std::logic_error("saving requires the source file to stay mapped");
+
+		auto source = static_cast<const unsigned char *>(m_mapping->base());
+
+		ExpressionEvaluator evaluator;
+
+		/*
+		 * Modified records are decoded again from the source file, into an
+		 * arena of their own, to compare their subrecords with.
+		 */
+		std::pmr::monotonic_buffer_resource originArena;
+		std::unordered_map<const RecordIndexEntry *, RecordOrigin> origins;
+
+		auto encode = [&](OutputSerializationStream *stream, const RecordIndexEntry &entry, const TESStruct *contents, bool modified) -> size_t {
+			if (!modified) {
+				if (stream) {
+					stream->writeExternal(source + entry.offset, entry.size);
+				}
+
+				return entry.size;
+			}
+
+			if (entry.projection)
+				throw std::logic_error("records loaded with a field projection can only be copied from the source file");
+
+			auto it = origins.find(&entry);
+			if (it == origins.end()) {
+				it = origins.emplace(&entry, RecordOrigin()).first;
+				decodeRecord(entry, &originArena, &it->second);
+			}
+
+			return encodeRecord(stream, *entry.definition, *contents, it->second, evaluator);
+		};
+
+		// Visits all records in file order, with skipped ones as unmodified
+		auto forEachRecord = [&](const auto &visit) {
+			auto skipped = m_skippedRecords.cbegin();
+			auto visitSkipped = [&](size_t position) {
+				for (; skipped != m_skippedRecords.cend() && skipped->position == position; ++skipped) {
+					visit(skipped->entry, nullptr, false);
+				}
+			};
+
+			visitSkipped(0);
+			visit(m_headerEntry, m_header, m_headerModified);
+
+			for (size_t index = 0, count = m_index.size(); index < count; index++) {
+				visitSkipped(index + 1);
+				visit(m_index[index], m_records[index].second, m_modified[index]);
+			}
+
+			visitSkipped(m_index.size() + 1);
+		};
+
+		size_t totalSize = 0;
+		size_t modifiedSize = 0;
+
+		forEachRecord([&](const RecordIndexEntry &entry, const TESStruct *contents, bool modified) {
+			auto size = encode(nullptr, entry, contents, modified);
+
+			totalSize += size;
+			if (modified) {
+				modifiedSize += size;
+			}
+		});
+
+		/*
+		 * Unmodified records are referenced in the mapping rather than copied,
+		 * so only modified ones take up buffer space.
+		 */
+		OutputSerializationStream stream;
+		stream.reserve(modifiedSize);
+
+		forEachRecord([&](const RecordIndexEntry &entry, const TESStruct *contents, bool modified) {
+			encode(&stream, entry, contents, modified);
+		});
+
+		if (stream.getCurrentPosition() != totalSize)
+			throw std::logic_error("encoded size doesn't match the computed size");
+
+		/*
+		 * The data is written to a temporary file and then moved into place,
+		 * so that the source file, which may still be mapped, is never
+		 * overwritten in place.
+		 */
+		std::string targetFilename(filename);
+		std::stringstream temporaryFilename;
+		temporaryFilename << targetFilename << "." << std::hex << std::random_device()() << ".tmp";
+
+		try {
+			stream.writeToFile(temporaryFilename.str());
+		}
+		catch (...) {
+			std::remove(temporaryFilename.str().c_str());
+			throw;
+		}
+
+		if (std::rename(temporaryFilename.str().c_str(), targetFilename.c_str()) != 0) {
+			// Windows doesn't replace existing files on rename
+			std::remove(targetFilename.c_str());
+
+			if (std::rename(temporaryFilename.str().c_str(), targetFilename.c_str()) != 0) {
+				std::remove(temporaryFilename.str().c_str());
+
+				std::stringstream error;
+				error << "Unable to replace " << targetFilename;
+				throw std::runtime_error(error.str());
+			}
+		}
+	}
+
+	size_t TESGameData::encodeRecord(SerializationStream *stream, const RecordDefinition &record, const TESStruct &contents, const RecordOrigin &origin, ExpressionEvaluator &evaluator) const {
+		try {
+			auto dataSize = encodeSubrecords(nullptr, record, contents, origin, evaluator);
+			auto size = encodeFraming(stream, *m_recordProgram, m_recordNameSlot, m_recordSizeSlot, m_recordDataSlot, record.fourcc, dataSize, &contents, evaluator);
+
+			if (stream) {
+				encodeSubrecords(stream, record, contents, origin, evaluator);
+			}
+
+			return size + dataSize;
+		}
+		catch (const std::exception &e) {
+			std::stringstream error;
+			error << record.name << ": " << e.what();
+			throw std::runtime_error(error.str());
+		}
+	}
+
+	size_t TESGameData::encodeSubrecords(SerializationStream *stream, const RecordDefinition &record, const TESStruct &contents, const RecordOrigin &origin, ExpressionEvaluator &evaluator) const {
+		size_t size = 0;
+
+		// Origin of a subrecord, if it was in the source record
+		auto findOrigin = [&](const SubrecordDefinition &subrecord, size_t member, const TESStruct *values, SubrecordOrigin &subrecordOrigin) -> const SubrecordOrigin * {
+			auto it = origin.subrecords.find(std::make_pair(&subrecord, member));
+			if (it == origin.subrecords.end())
+				return nullptr;
+
+			subrecordOrigin = SubrecordOrigin{ it->second, values };
+			return &subrecordOrigin;
+		};
+
+		SubrecordOrigin subrecordOrigin;
+
+		for (const auto &entry : record.entries) {
+			if (auto subrecord = std::get_if<SubrecordDefinition>(&entry)) {
+				size += encodeSubrecord(stream, *subrecord, contents, findOrigin(*subrecord, RecordOrigin::NoMember, origin.values, subrecordOrigin), evaluator);
+				continue;
+			}
+
+			const auto &array = std::get<SubrecordArrayDefinition>(entry);
+			auto arraySlot = record.layout.slot(array.name);
+
+			auto originalMembers = std::get_if<TESArray>(&origin.values->fields[arraySlot]);
+
+			const auto &field = contents.fields[arraySlot];
+			if (std::holds_alternative<std::monostate>(field))
+				continue;
+
+			auto members = std::get_if<TESArray>(&field);
+			if (!members) {
+				std::stringstream error;
+				error << array.name << ": expected an array of structures";
+				throw std::runtime_error(error.str());
+			}
+
+			for (size_t index = 0, count = members->values.size(); index < count; index++) {
+				auto member = std::get_if<TESStruct>(&members->values[index]);
+				if (!member || member->layout != &array.memberLayout) {
+					std::stringstream error;
+					error << array.name << ": members must be structures of the array's member layout";
+					throw std::runtime_error(error.str());
+				}
+
+				auto originalMember = originalMembers && index < originalMembers->values.size() ? &std::get<TESStruct>(originalMembers->values[index]) : nullptr;
+
+				for (const auto &subrecord : array.subrecords) {
+					auto memberOrigin = originalMember ? findOrigin(subrecord, index, originalMember, subrecordOrigin) : nullptr;
+					size += encodeSubrecord(stream, subrecord, *member, memberOrigin, evaluator);
+				}
+			}
+		}
+
+		return size;
+	}
+
+	/*
+	 * The subrecord is written if any of its fields is present in the
+	 * context, in which case all of them have to be. Nothing is known about
+	 * the contents of subrecords without fields, so unless they are copied
+	 * from the source file, they are written empty, and only if they are
+	 * required.
+	 */
+	bool TESGameData::subrecordPresent(const SubrecordDefinition &subrecord, const TESStruct &context) {
+		const auto *instruction = subrecord.program.instructions.data();
+		const auto *end = instruction + subrecord.program.instructions.size();
+
+		bool present = instruction == end && subrecord.required;
+		for (; instruction != end && !present; instruction += instruction->span) {
+			present = context.hasField(instruction->slot);
+		}
+
+		return present;
+	}
+
+	// Data of a subrecord as encoded from its fields, or false if it isn't written
+	bool TESGameData::encodeSubrecordData(const SubrecordDefinition &subrecord, const TESStruct &context, ExpressionEvaluator &evaluator, std::vector<unsigned char> &data) {
+		if (!subrecordPresent(subrecord, context))
+			return false;
+
+		OutputSerializationStream stream;
+		encodeFields(&stream, subrecord.program, context, evaluator);
+		data = stream.data();
+		return true;
+	}
+
+	/*
+	 * The source data of a subrecord is kept if its fields are unchanged.
+	 * Otherwise they are encoded, which is only allowed if the source data is
+	 * exactly what the decoded values encode to.
+	 */
+	bool TESGameData::keepSourceSubrecord(const SubrecordDefinition &subrecord, const TESStruct &context, const SubrecordOrigin &origin, ExpressionEvaluator &evaluator) const {
+		const auto *instruction = subrecord.program.instructions.data();
+		const auto *end = instruction + subrecord.program.instructions.size();
+
+		bool unchanged = true;
+		for (; instruction != end && unchanged; instruction += instruction->span) {
+			unchanged = sameValue(context.fields[instruction->slot], origin.values->fields[instruction->slot]);
+		}
+
+		if (unchanged)
+			return true;
+
+		std::vector<unsigned char> original;
+		if (encodeSubrecordData(subrecord, *origin.values, evaluator, original) &&
+			original.size() == origin.data.size && std::equal(original.begin(), original.end(), origin.data.data)) {
+			return false;
+		}
+
+		throw std::runtime_error("the subrecord has contents that its values don't describe, so they can't be changed");
+	}
+
+	size_t TESGameData::encodeSubrecord(SerializationStream *stream, const SubrecordDefinition &subrecord, const TESStruct &context, const SubrecordOrigin *origin, ExpressionEvaluator &evaluator) const {
+		if (origin) {
+			try {
+				if (keepSourceSubrecord(subrecord, context, *origin, evaluator)) {
+					auto size = encodeFraming(stream, *m_subrecordProgram, m_subrecordNameSlot, m_subrecordSizeSlot, m_subrecordDataSlot, subrecord.fourcc, origin->data.size, nullptr, evaluator);
+
+					if (stream && origin->data.size != 0) {
+						stream->writeData(origin->data.data, origin->data.size);
+					}
+
+					return size + origin->data.size;
+				}
+			}
+			catch (const std::exception &e) {
+				std::stringstream error;
+				error << fourCCToString(subrecord.fourcc) << ": " << e.what();
+				throw std::runtime_error(error.str());
+			}
+		}
+
+		if (!subrecordPresent(subrecord, context)) {
+			if (subrecord.required && !subrecord.program.instructions.empty()) {
+				std::stringstream error;
+				error << "required subrecord " << fourCCToString(subrecord.fourcc) << " is not present";
+				throw std::runtime_error(error.str());
+			}
+
+			return 0;
+		}
+
+		try {
+			auto dataSize = encodeFields(nullptr, subrecord.program, context, evaluator);
+			auto size = encodeFraming(stream, *m_subrecordProgram, m_subrecordNameSlot, m_subrecordSizeSlot, m_subrecordDataSlot, subrecord.fourcc, dataSize, nullptr, evaluator);
+
+			if (stream) {
+				encodeFields(stream, subrecord.program, context, evaluator);
+			}
+
+			return size + dataSize;
+		}
+		catch (const std::exception &e) {
+			std::stringstream error;
+			error << fourCCToString(subrecord.fourcc) << ": " << e.what();
+			throw std::runtime_error(error.str());
+		}
+	}
+
+	/*
+	 * Writes the Record or Subrecord structure up to its Data, which the
+	 * caller writes next. Fields other than Name, Size and Data are taken from
+	 * 'fields', the record contents, whose layout starts with the fields of
+	 * the Record structure.
+	 */
+	size_t TESGameData::encodeFraming(SerializationStream *stream, const DecodingProgram &program, TESFieldSlot nameSlot, TESFieldSlot sizeSlot, TESFieldSlot dataSlot, uint32_t fourcc, size_t dataSize, const TESStruct *fields, ExpressionEvaluator &evaluator) {
+		const auto *instruction = program.instructions.data();
+		const auto *end = instruction + program.instructions.size();
+
+		size_t size = 0;
+
+		for (; instruction != end; instruction += instruction->span) {
+			if (instruction->slot == dataSlot) {
+				if (instruction + instruction->span != end)
+					throw std::logic_error("Data must be the last field of the Record and Subrecord structures");
+
+				continue;
+			}
+
+			if (instruction->slot == nameSlot || instruction->slot == sizeSlot) {
+				if (instruction->opcode != DecodingOpcode::UInt32)
+					throw std::logic_error("Name and Size of the Record and Subrecord structures must be 32-bit");
+
+				if (instruction->slot == sizeSlot && dataSize > std::numeric_limits<uint32_t>::max())
+					throw std::runtime_error("data is too large");
+
+				if (stream) {
+					*stream << static_cast<uint32_t>(instruction->slot == nameSlot ? fourcc : dataSize);
+				}
+
+				size += sizeof(uint32_t);
+				continue;
+			}
+
+			if (!fields)
+				throw std::logic_error("the Subrecord structure can't have fields other than Name, Size and Data");
+
+			const auto &value = fields->fields[instruction->slot];
+			if (std::holds_alternative<std::monostate>(value)) {
+				std::stringstream error;
+				error << "field " << fields->fieldName(instruction->slot) << " is not present";
+				throw std::runtime_error(error.str());
+			}
+
+			size += encodeFieldValue(stream, instruction, value, *fields, evaluator);
+		}
+
+		return size;
+	}
+
+	size_t TESGameData::encodeFields(SerializationStream *stream, const DecodingProgram &program, const TESStruct &st, ExpressionEvaluator &evaluator) {
+		const auto *instruction = program.instructions.data();
+		const auto *end = instruction + program.instructions.size();
+
+		size_t size = 0;
+
+		for (; instruction != end; instruction += instruction->span) {
+			const auto &value = st.fields[instruction->slot];
+
+			try {
+				if (std::holds_alternative<std::monostate>(value))
+					throw std::runtime_error("not present");
+
+				size += encodeFieldValue(stream, instruction, value, st, evaluator);
+			}
+			catch (const std::exception &e) {
+				std::stringstream error;
+				error << "field " << st.fieldName(instruction->slot) << ": " << e.what();
+				throw std::runtime_error(error.str());
+			}
+		}
+
+		return size;
+	}
+
+	size_t TESGameData::encodeFieldValue(SerializationStream *stream, const DecodingInstruction *instruction, const TESValue &value, const TESStruct &context, ExpressionEvaluator &evaluator) {
+		switch (instruction->opcode) {
+		case DecodingOpcode::UInt32:
+			return encodeScalar<uint32_t, TESUInt>(stream, value, "UInt32");
+
+		case DecodingOpcode::Int8:
+			return encodeScalar<int8_t, TESInt>(stream, value, "Int8");
+
+		case DecodingOpcode::UInt8:
+			return encodeScalar<uint8_t, TESUInt>(stream, value, "UInt8");
+
+		case DecodingOpcode::UInt16:
+			return encodeScalar<uint16_t, TESUInt>(stream, value, "UInt16");
+
+		case DecodingOpcode::Int32:
+			return encodeScalar<int32_t, TESInt>(stream, value, "Int32");
+
+		case DecodingOpcode::Float:
+			return encodeScalar<float, float>(stream, value, "Float");
+
+		case DecodingOpcode::ByteArray:
+		{
+			const unsigned char *data;
+			size_t size;
+
+			if (auto bytes = std::get_if<std::pmr::vector<unsigned char>>(&value)) {
+				data = bytes->data();
+				size = bytes->size();
+			}
+			else if (auto view = std::get_if<TESByteArrayView>(&value)) {
+				data = view->data;
+				size = view->size;
+			}
+			else {
+				throw std::runtime_error("expected a byte array");
+			}
+
+			checkLength(encodedLength(instruction, context, evaluator), size);
+
+			if (stream && size != 0) {
+				stream->writeData(data, size);
+			}
+
+			return size;
+		}
+
+		case DecodingOpcode::String:
+		{
+			std::string_view string;
+
+			if (auto owned = std::get_if<std::pmr::string>(&value)) {
+				string = *owned;
+			}
+			else if (auto view = std::get_if<std::string_view>(&value)) {
+				string = *view;
+			}
+			else {
+				throw std::runtime_error("expected a string");
+			}
+
+			// Strings that extend to the end of their data are zero-terminated
+			auto length = encodedLength(instruction, context, evaluator);
+			if (length == DecodingInstruction::VariableSize) {
+				length = string.size() + 1;
+			}
+			else if (string.size() > length) {
+				std::stringstream error;
+				error << "length is " << string.size() << ", but the description allows at most " << length;
+				throw std::runtime_error(error.str());
+			}
+
+			if (stream) {
+				stream->writeData(reinterpret_cast<const unsigned char *>(string.data()), string.size());
+
+				for (size_t padding = string.size(); padding < length; padding++) {
+					*stream << static_cast<uint8_t>(0);
+				}
+			}
+
+			return length;
+		}
+
+		case DecodingOpcode::Array:
+		{
+			auto element = instruction + 1;
+			auto length = encodedLength(instruction, context, evaluator);
+
+			return std::visit([&](const auto &array) -> size_t {
+				using ArrayType = std::decay_t<decltype(array)>;
+
+				if constexpr (std::is_same<ArrayType, TESArray>::value) {
+					checkLength(length, array.values.size());
+
+					size_t size = 0;
+					for (const auto &entry : array.values) {
+						size += encodeFieldValue(stream, element, entry, context, evaluator);
+					}
+
+					return size;
+				}
+				else if constexpr (IsTypedArray<ArrayType>::value) {
+					checkLength(length, array.values.size());
+
+					if (element->opcode != typedArrayOpcode(array))
+						throw std::runtime_error("array element type doesn't match the description");
+
+					if (stream) {
+						for (auto entry : array.values) {
+							*stream << entry;
+						}
+					}
+
+					return array.values.size() * sizeof(typename decltype(array.values)::value_type);
+				}
+				else {
+					throw std::runtime_error("expected an array");
+				}
+			}, value);
+		}
+
+		case DecodingOpcode::Struct:
+		{
+			auto st = std::get_if<TESStruct>(&value);
+			if (!st || st->layout != instruction->structLayout)
+				throw std::runtime_error("expected a structure of the type in the description");
+
+			return encodeFields(stream, *instruction->structProgram, *st, evaluator);
+		}
+
+		default:
+		{
+			std::stringstream error;
+			error << "Unsupported opcode: " << static_cast<unsigned int>(instruction->opcode);
+			throw std::runtime_error(error.str());
+		}
+		}
+	}
+}
@@ -0,0 +1,81 @@
+#include <tesparse/TESValue.h>
+
+namespace tesparse {
+	TESStructLayout::TESStructLayout() = default;
+
+	TESStructLayout::~TESStructLayout() = default;
+
+	TESStructLayout::TESStructLayout(TESStructLayout &&other) = default;
+
+	TESStructLayout &TESStructLayout::operator =(TESStructLayout &&other) = default;
+
+	TESFieldSlot TESStructLayout::addField(const std::string &name) {
+		auto result = m_slots.emplace(name, m_fieldNames.size());
+		if (result.second) {
+			m_fieldNames.emplace_back(name);
+		}
+
+		return result.first->second;
+	}
+
+	const TESFieldSlot *TESStructLayout::tryGetSlot(const std::string &name) const {
+		auto it = m_slots.find(name);
+		if (it == m_slots.end())
+			return nullptr;
+
+		return &it->second;
+	}
+
+	TESFieldSlot TESStructLayout::slot(const std::string &name) const {
+		auto slot = tryGetSlot(name);
+		if (!slot)
+			throw std::logic_error("Field is not defined: " + name);
+
+		return *slot;
+	}
+
+	TESArray::TESArray() = default;
+
+	TESArray::TESArray(std::pmr::memory_resource *resource) : values(resource) {
+
+	}
+
+	TESArray::~TESArray() = default;
+
+	TESArray::TESArray(const TESArray &other) = default;
+
+	TESArray &TESArray::operator =(const TESArray &other) = default;
+
+	TESArray::TESArray(TESArray &&other) noexcept = default;
+
+	TESArray &TESArray::operator =(TESArray &&other) = default;
+
+	TESStruct::TESStruct() : layout(nullptr) {
+
+	}
+
+	TESStruct::TESStruct(const TESStructLayout *layout, std::pmr::memory_resource *resource) : layout(layout), fields(layout->size(), resource) {
+
+	}
+
+	TESStruct::~TESStruct() = default;
+
+	TESStruct::TESStruct(const TESStruct &other) = default;
+
+	TESStruct &TESStruct::operator =(const TESStruct &other) = default;
+
+	TESStruct::TESStruct(TESStruct &&other) noexcept = default;
+
+	TESStruct &TESStruct::operator =(TESStruct &&other) = default;
+
+	const TESValue *TESStruct::tryGetField(const std::string &name) const {
+		if (!layout)
+			return nullptr;
+
+		auto slot = layout->tryGetSlot(name);
+		if (!slot || !hasField(*slot))
+			return nullptr;
+
+		return &fields[*slot];
+	}
+}
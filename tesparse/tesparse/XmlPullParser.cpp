@@ -0,0 +1,486 @@
+#include <tesparse/XmlPullParser.h>
+
+#include <stdint.h>
+
+#include <stdexcept>
+#include <sstream>
+#include <cstring>
+
+namespace tesparse {
+	static inline bool isXmlSpace(char ch) {
+		return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+	}
+
+	// Any byte of a multibyte UTF-8 sequence is accepted as a name character
+	static inline bool isNameStartChar(char ch) {
+		return (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == '_' || ch == ':' || static_cast<unsigned char>(ch) >= 0x80;
+	}
+
+	static inline bool isNameChar(char ch) {
+		return isNameStartChar(ch) || (ch >= '0' && ch <= '9') || ch == '-' || ch == '.';
+	}
+
+	XmlPullParser::XmlPullParser(const char *data, size_t size) : m_begin(data), m_end(data + size), m_ptr(data), m_emptyElement(false), m_rootClosed(false) {
+		static const char byteOrderMark[]{ '\xEF', '\xBB', '\xBF' };
+
+		if (size >= sizeof(byteOrderMark) && memcmp(data, byteOrderMark, sizeof(byteOrderMark)) == 0) {
+			m_begin += sizeof(byteOrderMark);
+			m_ptr = m_begin;
+		}
+	}
+
+	XmlPullParser::~XmlPullParser() = default;
+
+	XmlNodeType XmlPullParser::read() {
+		m_name = std::string_view();
+		m_text = std::string_view();
+		m_emptyElement = false;
+		m_attributes.clear();
+		m_decoded.clear();
+
+		while (true) {
+			if (m_ptr == m_end) {
+				if (!m_openElements.empty())
+					error("unexpected EOF", m_ptr);
+
+				return XmlNodeType::None;
+			}
+
+			if (*m_ptr != '<') {
+				if (parseText())
+					return XmlNodeType::Text;
+			}
+			else if (startsWith("<!--")) {
+				m_ptr += 4;
+				skipPast("-->", "comment");
+			}
+			else if (startsWith("<![CDATA[")) {
+				if (m_openElements.empty())
+					error("CDATA section outside of the root element", m_ptr);
+
+				m_ptr += 9;
+				auto start = m_ptr;
+				skipPast("]]>", "CDATA section");
+
+				m_text = std::string_view(start, m_ptr - 3 - start);
+				if (!m_text.empty())
+					return XmlNodeType::Text;
+			}
+			else if (startsWith("<!DOCTYPE")) {
+				skipDoctype();
+			}
+			else if (startsWith("<?")) {
+				parseProcessingInstruction();
+			}
+			else if (startsWith("</")) {
+				parseEndTag();
+				return XmlNodeType::EndElement;
+			}
+			else {
+				parseStartTag();
+				return XmlNodeType::Element;
+			}
+		}
+	}
+
+	bool XmlPullParser::tryGetAttribute(const std::string_view &name, std::string_view &value) const {
+		for (const auto &attribute : m_attributes) {
+			if (attribute.name == name) {
+				value = attribute.value;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	const char *XmlPullParser::nodeTypeName(XmlNodeType type) {
+		switch (type) {
+		case XmlNodeType::None:
+			return "None";
+
+		case XmlNodeType::Element:
+			return "Element";
+
+		case XmlNodeType::EndElement:
+			return "EndElement";
+
+		case XmlNodeType::Text:
+			return "Text";
+
+		default:
+			return "unknown";
+		}
+	}
+
+	void XmlPullParser::error(const std::string &message, const char *position) const {
+		size_t line = 1;
+		auto lineStart = m_begin;
+
+		for (auto ptr = m_begin; ptr < position; ptr++) {
+			if (*ptr == '\n') {
+				line++;
+				lineStart = ptr + 1;
+			}
+		}
+
+		std::stringstream stream;
+		stream << "XML error at line " << line << ", column " << (position - lineStart + 1) << ": " << message;
+		throw std::runtime_error(stream.str());
+	}
+
+	void XmlPullParser::skipSpace() {
+		while (m_ptr != m_end && isXmlSpace(*m_ptr))
+			m_ptr++;
+	}
+
+	void XmlPullParser::skipPast(const std::string_view &terminator, const char *construct) {
+		auto start = m_ptr;
+		auto position = std::string_view(m_ptr, m_end - m_ptr).find(terminator);
+		if (position == std::string_view::npos)
+			error(std::string("unterminated ") + construct, start);
+
+		m_ptr += position + terminator.size();
+	}
+
+	/*
+	 * The internal subset may contain markup declarations with quoted
+	 * strings and comments, either of which may contain '>' or ']'.
+	 */
+	void XmlPullParser::skipDoctype() {
+		auto start = m_ptr;
+
+		if (!m_openElements.empty() || m_rootClosed)
+			error("misplaced document type declaration", start);
+
+		m_ptr += 9;
+
+		size_t depth = 0;
+		while (true) {
+			if (m_ptr == m_end)
+				error("unterminated document type declaration", start);
+
+			auto ch = *m_ptr;
+
+			if (ch == '\"' || ch == '\'') {
+				auto closing = static_cast<const char *>(memchr(m_ptr + 1, ch, m_end - m_ptr - 1));
+				if (!closing)
+					error("unterminated document type declaration", start);
+
+				m_ptr = closing + 1;
+			}
+			else if (startsWith("<!--")) {
+				m_ptr += 4;
+				skipPast("-->", "comment");
+			}
+			else if (ch == '[') {
+				depth++;
+				m_ptr++;
+			}
+			else if (ch == ']' && depth != 0) {
+				depth--;
+				m_ptr++;
+			}
+			else if (ch == '>' && depth == 0) {
+				m_ptr++;
+				return;
+			}
+			else {
+				m_ptr++;
+			}
+		}
+	}
+
+	void XmlPullParser::parseProcessingInstruction() {
+		auto start = m_ptr;
+		m_ptr += 2;
+
+		auto target = parseName();
+		auto contentStart = m_ptr;
+		skipPast("?>", "processing instruction");
+
+		if (target != "xml")
+			return;
+
+		if (start != m_begin)
+			error("misplaced XML declaration", start);
+
+		std::string_view content(contentStart, m_ptr - 2 - contentStart);
+		auto encodingPosition = content.find("encoding");
+		if (encodingPosition == std::string_view::npos)
+			return;
+
+		auto valueStart = content.find_first_of("\"\'", encodingPosition);
+		if (valueStart == std::string_view::npos)
+			error("malformed XML declaration", start);
+
+		auto valueEnd = content.find(content[valueStart], valueStart + 1);
+		if (valueEnd == std::string_view::npos)
+			error("malformed XML declaration", start);
+
+		auto encoding = content.substr(valueStart + 1, valueEnd - valueStart - 1);
+
+		std::string normalized;
+		for (auto ch : encoding) {
+			normalized.push_back(ch >= 'A' && ch <= 'Z' ? static_cast<char>(ch - 'A' + 'a') : ch);
+		}
+
+		if (normalized != "utf-8" && normalized != "utf8")
+			error("unsupported document encoding: " + std::string(encoding), start);
+	}
+
+	std::string_view XmlPullParser::parseName() {
+		auto start = m_ptr;
+
+		if (m_ptr == m_end || !isNameStartChar(*m_ptr))
+			error("name expected", m_ptr);
+
+		do {
+			m_ptr++;
+		} while (m_ptr != m_end && isNameChar(*m_ptr));
+
+		return std::string_view(start, m_ptr - start);
+	}
+
+	void XmlPullParser::parseStartTag() {
+		auto start = m_ptr;
+
+		if (m_rootClosed)
+			error("content after the root element", start);
+
+		m_ptr++;
+		m_name = parseName();
+
+		while (true) {
+			auto spaceStart = m_ptr;
+			skipSpace();
+
+			if (m_ptr == m_end)
+				error("unterminated start tag", start);
+
+			if (*m_ptr == '>') {
+				m_ptr++;
+				break;
+			}
+
+			if (startsWith("/>")) {
+				m_ptr += 2;
+				m_emptyElement = true;
+				break;
+			}
+
+			if (m_ptr == spaceStart)
+				error("whitespace expected", m_ptr);
+
+			auto attributeStart = m_ptr;
+			auto name = parseName();
+
+			skipSpace();
+			if (m_ptr == m_end || *m_ptr != '=')
+				error("'=' expected", m_ptr);
+
+			m_ptr++;
+			skipSpace();
+
+			if (m_ptr == m_end || (*m_ptr != '\"' && *m_ptr != '\''))
+				error("quoted attribute value expected", m_ptr);
+
+			auto valueStart = m_ptr + 1;
+			auto valueEnd = static_cast<const char *>(memchr(valueStart, *m_ptr, m_end - valueStart));
+			if (!valueEnd)
+				error("unterminated attribute value", m_ptr);
+
+			if (memchr(valueStart, '<', valueEnd - valueStart))
+				error("'<' in attribute value", valueStart);
+
+			m_ptr = valueEnd + 1;
+
+			std::string_view existing;
+			if (tryGetAttribute(name, existing))
+				error("duplicate attribute: " + std::string(name), attributeStart);
+
+			m_attributes.emplace_back(Attribute{ name, decode(valueStart, valueEnd, true) });
+		}
+
+		if (!m_emptyElement)
+			m_openElements.push_back(m_name);
+		else if (m_openElements.empty())
+			m_rootClosed = true;
+	}
+
+	void XmlPullParser::parseEndTag() {
+		auto start = m_ptr;
+
+		m_ptr += 2;
+		m_name = parseName();
+
+		skipSpace();
+		if (m_ptr == m_end || *m_ptr != '>')
+			error("'>' expected", m_ptr);
+
+		m_ptr++;
+
+		if (m_openElements.empty() || m_openElements.back() != m_name)
+			error("mismatched end tag: " + std::string(m_name), start);
+
+		m_openElements.pop_back();
+
+		if (m_openElements.empty())
+			m_rootClosed = true;
+	}
+
+	bool XmlPullParser::parseText() {
+		auto start = m_ptr;
+
+		auto next = static_cast<const char *>(memchr(m_ptr, '<', m_end - m_ptr));
+		m_ptr = next ? next : m_end;
+
+		bool whitespace = true;
+		for (auto ptr = start; ptr != m_ptr; ptr++) {
+			if (!isXmlSpace(*ptr)) {
+				whitespace = false;
+				break;
+			}
+		}
+
+		if (whitespace)
+			return false;
+
+		if (m_openElements.empty())
+			error("text outside of the root element", start);
+
+		m_text = decode(start, m_ptr, false);
+
+		return true;
+	}
+
+	/*
+	 * Expands references and normalizes line ends; attribute values also have
+	 * their whitespace characters replaced by spaces. Values that need none of
+	 * this are returned as is.
+	 */
+	std::string_view XmlPullParser::decode(const char *begin, const char *end, bool attribute) {
+		bool plain = true;
+		for (auto ptr = begin; ptr != end; ptr++) {
+			auto ch = *ptr;
+			if (ch == '&' || ch == '\r' || (attribute && (ch == '\t' || ch == '\n'))) {
+				plain = false;
+				break;
+			}
+		}
+
+		if (plain)
+			return std::string_view(begin, end - begin);
+
+		auto &output = m_decoded.emplace_back();
+		output.reserve(end - begin);
+
+		auto ptr = begin;
+		while (ptr != end) {
+			auto ch = *ptr;
+
+			if (ch == '&') {
+				appendReference(ptr, end, output);
+				continue;
+			}
+
+			if (ch == '\r') {
+				if (ptr + 1 != end && ptr[1] == '\n')
+					ptr++;
+
+				ch = '\n';
+			}
+
+			if (attribute && (ch == '\t' || ch == '\n'))
+				ch = ' ';
+
+			output.push_back(ch);
+			ptr++;
+		}
+
+		return output;
+	}
+
+	void XmlPullParser::appendReference(const char *&ptr, const char *end, std::string &output) {
+		auto start = ptr;
+
+		auto semicolon = static_cast<const char *>(memchr(ptr, ';', end - ptr));
+		if (!semicolon)
+			error("unterminated reference", start);
+
+		std::string_view name(ptr + 1, semicolon - ptr - 1);
+		ptr = semicolon + 1;
+
+		if (!name.empty() && name.front() == '#') {
+			unsigned int base = 10;
+			size_t position = 1;
+
+			if (name.size() > 1 && name[1] == 'x') {
+				base = 16;
+				position = 2;
+			}
+
+			if (position == name.size())
+				error("malformed character reference", start);
+
+			uint32_t codePoint = 0;
+			for (; position < name.size(); position++) {
+				auto ch = name[position];
+				unsigned int digit;
+
+				if (ch >= '0' && ch <= '9')
+					digit = ch - '0';
+				else if (base == 16 && ch >= 'a' && ch <= 'f')
+					digit = ch - 'a' + 10;
+				else if (base == 16 && ch >= 'A' && ch <= 'F')
+					digit = ch - 'A' + 10;
+				else
+					error("malformed character reference", start);
+
+				codePoint = codePoint * base + digit;
+				if (codePoint > 0x10FFFF)
+					error("character reference out of range", start);
+			}
+
+			if (codePoint == 0 || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+				error("character reference out of range", start);
+
+			if (codePoint < 0x80) {
+				output.push_back(static_cast<char>(codePoint));
+			}
+			else if (codePoint < 0x800) {
+				output.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+				output.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+			}
+			else if (codePoint < 0x10000) {
+				output.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+				output.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+				output.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+			}
+			else {
+				output.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+				output.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+				output.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+				output.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+			}
+		}
+		else if (name == "lt") {
+			output.push_back('<');
+		}
+		else if (name == "gt") {
+			output.push_back('>');
+		}
+		else if (name == "amp") {
+			output.push_back('&');
+		}
+		else if (name == "apos") {
+			output.push_back('\'');
+		}
+		else if (name == "quot") {
+			output.push_back('\"');
+		}
+		else {
+			error("undefined entity: " + std::string(name), start);
+		}
+	}
+}
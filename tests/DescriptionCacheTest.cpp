@@ -0,0 +1,53 @@
+#include "TestSupport.h"
+
+#include <tesparse/TESFileFormatDescription.h>
+#include <tesparse/FourCC.h>
+
+using namespace tesparse;
+using namespace tesparse::tests;
+
+namespace {
+	// Loading the binary form and serializing it again gives the same bytes
+	void serializationIsStable() {
+		auto xml = readFile(descriptionFile("morrowind.xml"));
+
+		TESFileFormatDescription fromXml;
+		fromXml.loadFromMemory(xml.data(), static_cast<unsigned int>(xml.size()));
+		auto binary = fromXml.serialize();
+
+		TESFileFormatDescription fromBinary;
+		fromBinary.loadFromMemory(binary.data(), static_cast<unsigned int>(binary.size()));
+
+		TESPARSE_CHECK(fromBinary.serialize() == binary);
+		TESPARSE_CHECK(fromXml.serialize() == binary);
+
+		const auto *faction = fromBinary.tryGetRecordByFourCC(fourCCFromString("FACT"));
+		TESPARSE_CHECK(faction != nullptr);
+		TESPARSE_CHECK(faction->name == "Faction");
+		TESPARSE_CHECK(faction->entries.size() == fromXml.tryGetRecordByFourCC(fourCCFromString("FACT"))->entries.size());
+	}
+
+	void cacheFileIsUsed() {
+		auto filename = descriptionFile("morrowind.xml");
+		std::string cacheFilename("DescriptionCacheTest.tesd");
+		std::remove(cacheFilename.c_str());
+
+		TESFileFormatDescription first;
+		first.loadFromFile(filename, cacheFilename);
+		auto cache = readFile(cacheFilename);
+		TESPARSE_CHECK(cache == first.serialize());
+
+		TESFileFormatDescription second;
+		second.loadFromFile(filename, cacheFilename);
+		TESPARSE_CHECK(second.serialize() == cache);
+
+		std::remove(cacheFilename.c_str());
+	}
+}
+
+int main() {
+	return runTests({
+		{ "serializationIsStable", serializationIsStable },
+		{ "cacheFileIsUsed", cacheFileIsUsed },
+	});
+}
@@ -0,0 +1,95 @@
+#include "TestSupport.h"
+
+#include <tesparse/ExpressionParser.h>
+#include <tesparse/ExpressionEvaluator.h>
+
+using namespace tesparse;
+using namespace tesparse::tests;
+
+namespace {
+	/*
+	 * The cases below use the same value for both operands of shifts and
+	 * divisions, so they don't depend on the operand order.
+	 */
+	struct Fixture {
+		TESStructLayout layout;
+		TESFieldSlot countSlot;
+		TESFieldSlot zeroSlot;
+		TESFieldSlot minusOneSlot;
+		TESFieldSlot threeSlot;
+
+		Fixture() {
+			countSlot = layout.addField("Count");
+			zeroSlot = layout.addField("Zero");
+			minusOneSlot = layout.addField("MinusOne");
+			threeSlot = layout.addField("Three");
+		}
+
+		CompiledExpression compile(const char *source) const {
+			ExpressionParser parser;
+			parser.parse(source);
+			return ExpressionEvaluator::compile(parser.expression(), layout);
+		}
+
+		ExpressionInteger evaluate(const char *source, TESInt count) const {
+			TESStruct context(&layout);
+			context.fields[countSlot] = count;
+			context.fields[zeroSlot] = TESInt(0);
+			context.fields[minusOneSlot] = TESInt(-1);
+			context.fields[threeSlot] = TESInt(3);
+
+			ExpressionEvaluator evaluator;
+			return evaluator.evaluate(compile(source), context);
+		}
+	};
+
+	void shiftsInRange() {
+		Fixture fixture;
+
+		TESPARSE_CHECK(fixture.evaluate("Three << Three", 0) == 24);
+		TESPARSE_CHECK(fixture.evaluate("Three >> Three", 0) == 0);
+		TESPARSE_CHECK(fixture.evaluate("Count << Count", 31) == static_cast<ExpressionInteger>(0x80000000u));
+		TESPARSE_CHECK(fixture.evaluate("Count >> Count", 31) == 0);
+	}
+
+	void shiftsOutOfRangeThrow() {
+		Fixture fixture;
+
+		for (auto count : { 32, 33, 1000, -1, -32 }) {
+			TESPARSE_CHECK_THROWS(fixture.evaluate("Count << Count", count));
+			TESPARSE_CHECK_THROWS(fixture.evaluate("Count >> Count", count));
+		}
+
+		TESPARSE_CHECK_THROWS(fixture.evaluate("MinusOne << MinusOne", 0));
+	}
+
+	// Constant operations that would throw are left to run time, and are only an error if evaluated
+	void trappingConstantsAreNotFolded() {
+		Fixture fixture;
+
+		TESPARSE_CHECK(fixture.compile("3 << 3").steps.size() == 1);
+		TESPARSE_CHECK(fixture.evaluate("3 << 3", 0) == 24);
+
+		for (auto source : { "40 << 40", "40 >> 40", "0 / 0", "0 % 0" }) {
+			TESPARSE_CHECK(fixture.compile(source).steps.size() == 3);
+			TESPARSE_CHECK_THROWS(fixture.evaluate(source, 0));
+		}
+	}
+
+	void divisionsThatTrapThrow() {
+		Fixture fixture;
+
+		TESPARSE_CHECK_THROWS(fixture.evaluate("Zero / Zero", 0));
+		TESPARSE_CHECK_THROWS(fixture.evaluate("Zero % Zero", 0));
+		TESPARSE_CHECK(fixture.evaluate("MinusOne / MinusOne", 0) == 1);
+	}
+}
+
+int main() {
+	return runTests({
+		{ "shiftsInRange", shiftsInRange },
+		{ "shiftsOutOfRangeThrow", shiftsOutOfRangeThrow },
+		{ "trappingConstantsAreNotFolded", trappingConstantsAreNotFolded },
+		{ "divisionsThatTrapThrow", divisionsThatTrapThrow },
+	});
+}
@@ -0,0 +1,190 @@
+#include "TestSupport.h"
+
+#include <limits>
+#include <sstream>
+
+#include "JsonWriter.h"
+#include "nlohmann/json.hpp"
+
+using namespace tesparse::tests;
+
+namespace {
+	using Json = nlohmann::json;
+
+	const std::vector<std::string> sampleStrings{
+		"",
+		"plain",
+		"quote \" backslash \\ slash /",
+		"control \b\f\n\r\t \x01\x1f \x7f",
+		std::string("embedded \0 zero", 15),
+		"UTF-8 \xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80",
+		"invalid \xff byte",
+		"truncated \xe2\x82",
+		"truncated at end \xc3",
+		"overlong \xc0\xaf",
+		"surrogate \xed\xa0\x80",
+		"continuation \x80\x80 only",
+		"Windows-1252 caf\xe9",
+	};
+
+	const std::vector<float> sampleFloats{
+		0.0f,
+		-0.0f,
+		1.0f,
+		-1.5f,
+		0.1f,
+		1.0f / 3.0f,
+		100.0f,
+		1e7f,
+		1e21f,
+		1e-7f,
+		123456.789f,
+		std::numeric_limits<float>::min(),
+		std::numeric_limits<float>::denorm_min(),
+		std::numeric_limits<float>::max(),
+		std::numeric_limits<float>::lowest(),
+		std::numeric_limits<float>::infinity(),
+		-std::numeric_limits<float>::infinity(),
+		std::numeric_limits<float>::quiet_NaN(),
+	};
+
+	const std::vector<uint32_t> sampleUInts{ 0, 1, 9, 10, 99, 100, 4294967295u };
+	const std::vector<int32_t> sampleInts{ 0, -1, 7, -10, 2147483647, -2147483647 - 1 };
+
+	/*
+	 * Writes the sample document with JsonWriter and builds the same document
+	 * for nlohmann::json, which sorts object keys, so keys are written in
+	 * sorted order.
+	 */
+	void writeDocument(JsonWriter &writer, Json &json) {
+		writer.beginObject();
+
+		writer.key("empty");
+		writer.beginObject();
+		writer.key("array");
+		writer.beginArray();
+		writer.endArray();
+		writer.key("object");
+		writer.beginObject();
+		writer.endObject();
+		writer.endObject();
+		json["empty"]["array"] = Json::array();
+		json["empty"]["object"] = Json::object();
+
+		writer.key("floats");
+		writer.beginArray();
+		json["floats"] = Json::array();
+		for (auto value : sampleFloats) {
+			writer.value(value);
+			json["floats"].push_back(value);
+		}
+		writer.endArray();
+
+		writer.key("integers");
+		writer.beginArray();
+		json["integers"] = Json::array();
+		for (auto value : sampleUInts) {
+			writer.value(value);
+			json["integers"].push_back(value);
+		}
+		for (auto value : sampleInts) {
+			writer.value(value);
+			json["integers"].push_back(value);
+		}
+		writer.endArray();
+
+		writer.key("key \"\xff\" \n");
+		writer.null();
+		json["key \"\xff\" \n"] = nullptr;
+
+		writer.key("strings");
+		writer.beginArray();
+		json["strings"] = Json::array();
+		for (const auto &string : sampleStrings) {
+			writer.value(string);
+			json["strings"].push_back(string);
+		}
+		writer.endArray();
+
+		writer.endObject();
+	}
+
+	std::string dump(const Json &json, int indent) {
+		return json.dump(indent, ' ', false, nlohmann::detail::error_handler_t::replace);
+	}
+
+	void matchesNlohmann(bool pretty) {
+		std::stringstream stream;
+		Json json;
+
+		{
+			JsonWriter writer(stream, pretty);
+			writeDocument(writer, json);
+			writer.flush();
+		}
+
+		auto expected = dump(json, pretty ? 2 : -1);
+		if (stream.str() != expected) {
+			std::stringstream error;
+			error << "output differs from nlohmann::json:\n" << stream.str() << "\nexpected:\n" << expected;
+			throw std::runtime_error(error.str());
+		}
+	}
+
+	void matchesNlohmannPretty() {
+		matchesNlohmann(true);
+	}
+
+	void matchesNlohmannCompact() {
+		matchesNlohmann(false);
+	}
+
+	// Each sample on its own, so a mismatch names the value
+	void matchesNlohmannPerValue() {
+		for (const auto &string : sampleStrings) {
+			JsonWriter writer(false);
+			writer.value(string);
+			TESPARSE_CHECK(writer.takeBuffer() == dump(Json(string), -1));
+		}
+
+		for (auto value : sampleFloats) {
+			JsonWriter writer(false);
+			writer.value(value);
+			TESPARSE_CHECK(writer.takeBuffer() == dump(Json(value), -1));
+		}
+	}
+
+	// A fragment written by another writer splices in as if written directly
+	void fragmentsMatchDirectOutput() {
+		for (auto pretty : { false, true }) {
+			JsonWriter direct(pretty);
+			direct.beginArray();
+			direct.value(uint32_t(1));
+			direct.value(std::string_view("two"));
+			direct.value(3.5f);
+			direct.endArray();
+
+			JsonWriter fragment(pretty);
+			fragment.beginFragment(1, true);
+			fragment.value(std::string_view("two"));
+			fragment.value(3.5f);
+
+			JsonWriter spliced(pretty);
+			spliced.beginArray();
+			spliced.value(uint32_t(1));
+			spliced.writeFragment(fragment.takeBuffer());
+			spliced.endArray();
+
+			TESPARSE_CHECK(spliced.takeBuffer() == direct.takeBuffer());
+		}
+	}
+}
+
+int main() {
+	return runTests({
+		{ "matchesNlohmannPretty", matchesNlohmannPretty },
+		{ "matchesNlohmannCompact", matchesNlohmannCompact },
+		{ "matchesNlohmannPerValue", matchesNlohmannPerValue },
+		{ "fragmentsMatchDirectOutput", fragmentsMatchDirectOutput },
+	});
+}
@@ -0,0 +1,165 @@
+#include "TestSupport.h"
+
+#include <tesparse/TESFileFormatDescription.h>
+#include <tesparse/TESGameData.h>
+#include <tesparse/FourCC.h>
+
+#include <regex>
+#include <set>
+
+using namespace tesparse;
+using namespace tesparse::tests;
+
+namespace {
+	// FourCCs of all records of a description, from its XML source
+	std::vector<uint32_t> recordFourCCs(const std::string &filename) {
+		auto source = readFile(filename);
+		std::string text(source.begin(), source.end());
+
+		std::vector<uint32_t> fourccs;
+		std::regex recordTag("<Record\\s+FourCC=\"(....)\"");
+		for (auto it = std::sregex_iterator(text.begin(), text.end(), recordTag); it != std::sregex_iterator(); ++it) {
+			fourccs.push_back(fourCCFromString((*it)[1].str()));
+		}
+
+		return fourccs;
+	}
+
+	void collectAlphabet(const RecordDefinition &record, std::set<uint32_t> &alphabet) {
+		for (const auto &entry : record.entries) {
+			if (auto subrecord = std::get_if<SubrecordDefinition>(&entry)) {
+				alphabet.insert(subrecord->fourcc);
+			}
+			else {
+				const auto &array = std::get<SubrecordArrayDefinition>(entry);
+				alphabet.insert(array.leader.begin(), array.leader.end());
+				for (const auto &subrecord : array.subrecords) {
+					alphabet.insert(subrecord.fourcc);
+				}
+			}
+		}
+	}
+
+	/*
+	 * Every state of every record against every FourCC used anywhere in the
+	 * description, so FourCCs that a record doesn't mention are covered too.
+	 */
+	void transitionsMatchReference() {
+		auto filename = descriptionFile("morrowind.xml");
+
+		TESFileFormatDescription desc;
+		desc.loadFromFile(filename);
+
+		auto fourccs = recordFourCCs(filename);
+		TESPARSE_CHECK(!fourccs.empty());
+
+		std::set<uint32_t> alphabet{ fourCCFromString("XXXX") };
+		for (auto fourcc : fourccs) {
+			auto record = desc.tryGetRecordByFourCC(fourcc);
+			TESPARSE_CHECK(record != nullptr);
+			collectAlphabet(*record, alphabet);
+		}
+
+		size_t accepted = 0;
+
+		for (auto recordFourCC : fourccs) {
+			const auto &record = *desc.tryGetRecordByFourCC(recordFourCC);
+			const auto &stateMachine = record.stateMachine;
+
+			for (uint32_t state = 0; state < stateMachine.stateCount(); state++) {
+				for (auto fourcc : alphabet) {
+					SubrecordTransition expected;
+					auto expectedAccepted = stateMachine.referenceTransition(record, state, fourcc, expected);
+					auto actual = stateMachine.transition(state, fourcc);
+
+					TESPARSE_CHECK((actual != nullptr) == expectedAccepted);
+					if (!actual)
+						continue;
+
+					TESPARSE_CHECK(actual->action == expected.action);
+					TESPARSE_CHECK(actual->openArray == expected.openArray);
+					TESPARSE_CHECK(actual->pushMember == expected.pushMember);
+					TESPARSE_CHECK(actual->nextState == expected.nextState);
+					TESPARSE_CHECK(actual->subrecord == expected.subrecord);
+					TESPARSE_CHECK(actual->array == expected.array);
+					TESPARSE_CHECK(actual->arraySlot == expected.arraySlot);
+					accepted++;
+				}
+			}
+		}
+
+		TESPARSE_CHECK(accepted != 0);
+	}
+
+	/*
+	 * The first subrecord of a subrecord array that follows another array
+	 * starts a new member of its own array, instead of going into the last
+	 * member of the previous one.
+	 */
+	void secondArrayStartsNewMember() {
+		TESFileFormatDescription desc;
+		desc.loadFromFile(descriptionFile("morrowind.xml"));
+
+		const auto &faction = *desc.tryGetRecordByFourCC(fourCCFromString("FACT"));
+		const auto &stateMachine = faction.stateMachine;
+
+		std::vector<unsigned char> fadt(4 * 2 + 20 * 10 + 4 * 6 + 4 + 4, 0);
+
+		auto filename = std::string("SubrecordStateMachineTest.esp");
+		writeFile(filename, PluginBuilder()
+			.header()
+			.record("FACT")
+			.subrecord("NAME", Bytes().string("faction"))
+			.subrecord("FNAM", Bytes().string("Faction"))
+			.subrecord("RNAM", Bytes().string("first"))
+			.subrecord("RNAM", Bytes().string("second"))
+			.subrecord("FADT", fadt)
+			.subrecord("ANAM", Bytes().string("other"))
+			.subrecord("INTV", Bytes().int32(-1))
+			.subrecord("ANAM", Bytes().string("another"))
+			.subrecord("INTV", Bytes().int32(2))
+			.finish());
+
+		// The state machine: ANAM after FADT opens Relations with a new member
+		uint32_t state = SubrecordStateMachine::InitialState;
+		for (const char *fourcc : { "NAME", "FNAM", "RNAM", "RNAM", "FADT" }) {
+			auto transition = stateMachine.transition(state, fourCCFromString(fourcc));
+			TESPARSE_CHECK(transition != nullptr);
+			state = transition->nextState;
+		}
+
+		auto transition = stateMachine.transition(state, fourCCFromString("ANAM"));
+		TESPARSE_CHECK(transition != nullptr);
+		TESPARSE_CHECK(transition->action == SubrecordAction::ArraySubrecord);
+		TESPARSE_CHECK(transition->openArray);
+		TESPARSE_CHECK(transition->pushMember);
+		TESPARSE_CHECK(transition->array->name == "Relations");
+
+		// Decoding: the members end up in their own arrays
+		TESGameData data;
+		data.load(filename, desc);
+		std::remove(filename.c_str());
+
+		TESPARSE_CHECK(data.recordCount() == 1);
+		const auto &record = data.record(0);
+
+		const auto &ranks = record.value<TESArray>("Ranks").values;
+		TESPARSE_CHECK(ranks.size() == 2);
+		TESPARSE_CHECK(std::get<TESStruct>(ranks[1]).value<std::pmr::string>("RankName") == "second");
+		TESPARSE_CHECK(std::get<TESStruct>(ranks[1]).tryGetField("OtherFactionName") == nullptr);
+
+		const auto &relations = record.value<TESArray>("Relations").values;
+		TESPARSE_CHECK(relations.size() == 2);
+		TESPARSE_CHECK(std::get<TESStruct>(relations[0]).value<std::pmr::string>("OtherFactionName") == "other");
+		TESPARSE_CHECK(std::get<TESStruct>(relations[0]).value<TESInt>("Reaction") == -1);
+		TESPARSE_CHECK(std::get<TESStruct>(relations[1]).value<std::pmr::string>("OtherFactionName") == "another");
+		TESPARSE_CHECK(std::get<TESStruct>(relations[1]).value<TESInt>("Reaction") == 2);
+	}
+}
+
+int main() {
+	return runTests({
+		{ "transitionsMatchReference", transitionsMatchReference },
+		{ "secondArrayStartsNewMember", secondArrayStartsNewMember },
+	});
+}
@@ -0,0 +1,212 @@
+#include "TestSupport.h"
+
+#include <tesparse/TESFileFormatDescription.h>
+#include <tesparse/TESGameData.h>
+
+#include <cstring>
+
+using namespace tesparse;
+using namespace tesparse::tests;
+
+namespace {
+	const char *pluginFilename = "TESGameDataPatchingTest.esp";
+
+	/*
+	 * A record with a field after a variable-length array, whose offset
+	 * therefore isn't known from the layout alone.
+	 */
+	const char *variableOffsetDescription = R"(<?xml version="1.0" encoding="utf-8"?>
+<Layout Encoding="Windows-1252">
+  <RecordOrder>
+    <Header Name="Header" />
+  </RecordOrder>
+  <Types>
+    <Struct Name="Record">
+      <Field Name="Name"><FourCC /></Field>
+      <Field Name="Size"><UInt32 /></Field>
+      <Field Name="Flags1"><UInt32 /></Field>
+      <Field Name="Flags2"><UInt32 /></Field>
+      <Field Name="Data"><ByteArray Length="Size" /></Field>
+    </Struct>
+    <Struct Name="Subrecord">
+      <Field Name="Name"><FourCC /></Field>
+      <Field Name="Size"><UInt32 /></Field>
+      <Field Name="Data"><ByteArray Length="Size" /></Field>
+    </Struct>
+    <Record FourCC="TES3" Name="Header">
+      <Subrecord FourCC="HEDR" Presence="Required">
+        <Field Name="Version"><Float /></Field>
+        <Field Name="Unknown"><UInt32 /></Field>
+        <Field Name="Author"><String Length="32" /></Field>
+        <Field Name="Description"><String Length="256" /></Field>
+      </Subrecord>
+    </Record>
+    <Record FourCC="LIST" Name="List">
+      <Subrecord FourCC="DATA" Presence="Required">
+        <Field Name="Count"><UInt32 /></Field>
+        <Field Name="Values"><Array Length="Count"><UInt32 /></Array></Field>
+        <Field Name="Trailer"><UInt32 /></Field>
+      </Subrecord>
+    </Record>
+  </Types>
+</Layout>
+)";
+
+	std::vector<unsigned char> buildPlugin() {
+		return PluginBuilder()
+			.header({ { "Morrowind.esm", 79837557 }, { "Tribunal.esm", 4565686 } })
+			.record("GLOB")
+			.subrecord("NAME", Bytes().string("Counter"))
+			.subrecord("FNAM", Bytes().string("f"))
+			.subrecord("FLTV", Bytes().float32(1.5f))
+			.record("GLOB")
+			.subrecord("NAME", Bytes().string("Drifted"))
+			.subrecord("FNAM", Bytes().string("f"))
+			.subrecord("FLTV", Bytes().float32(1.5f).uint32(0))
+			.finish();
+	}
+
+	TESLoadOptions writableOptions() {
+		TESLoadOptions options;
+		options.mapping.writable = true;
+		return options;
+	}
+
+	/*
+	 * Patches the plugin through a writable mapping, then decodes it again
+	 * with a separate TESGameData for checking.
+	 */
+	template<typename Patch, typename Check>
+	void patchAndReload(const TESFileFormatDescription &desc, Patch &&patch, Check &&check) {
+		writeFile(pluginFilename, buildPlugin());
+		auto before = readFile(pluginFilename);
+
+		{
+			TESGameData data;
+			data.load(pluginFilename, desc, writableOptions());
+			patch(data);
+			data.flush();
+		}
+
+		auto after = readFile(pluginFilename);
+		TESPARSE_CHECK(after.size() == before.size());
+
+		TESGameData reloaded;
+		reloaded.load(pluginFilename, desc);
+		check(reloaded);
+
+		std::remove(pluginFilename);
+	}
+
+	void patchesRecordHeaderField() {
+		TESFileFormatDescription desc;
+		desc.loadFromFile(descriptionFile("morrowind.xml"));
+
+		patchAndReload(desc, [](TESGameData &data) {
+			data.patchField(0, "Flags1", TESUInt(0x2000));
+		}, [](const TESGameData &data) {
+			TESPARSE_CHECK(data.record(0).value<TESUInt>("Flags1") == 0x2000);
+			TESPARSE_CHECK(data.record(0).value<float>("DefaultValue") == 1.5f);
+			TESPARSE_CHECK(data.record(1).value<TESUInt>("Flags1") == 0);
+		});
+	}
+
+	void patchesSubrecordField() {
+		TESFileFormatDescription desc;
+		desc.loadFromFile(descriptionFile("morrowind.xml"));
+
+		patchAndReload(desc, [](TESGameData &data) {
+			data.patchField(0, "DefaultValue", 42.0f);
+			data.patchHeaderField("Version", 1.3f);
+		}, [](const TESGameData &data) {
+			TESPARSE_CHECK(data.record(0).value<float>("DefaultValue") == 42.0f);
+			TESPARSE_CHECK(data.record(0).value<std::pmr::string>("Name") == "Counter");
+			TESPARSE_CHECK(data.header()->value<float>("Version") == 1.3f);
+		});
+	}
+
+	void patchesArrayMemberField() {
+		TESFileFormatDescription desc;
+		desc.loadFromFile(descriptionFile("morrowind.xml"));
+
+		patchAndReload(desc, [](TESGameData &data) {
+			data.patchHeaderField("Masters[1].MasterFileSize", TESUInt(1234));
+		}, [](const TESGameData &data) {
+			const auto &masters = data.header()->value<TESArray>("Masters").values;
+			TESPARSE_CHECK(masters.size() == 2);
+
+			const auto &first = std::get<TESStruct>(masters[0]);
+			const auto &second = std::get<TESStruct>(masters[1]);
+			TESPARSE_CHECK(first.value<TESUInt>("MasterFileSize") == 79837557);
+			TESPARSE_CHECK(second.value<TESUInt>("MasterFileSize") == 1234);
+			TESPARSE_CHECK(second.value<std::pmr::string>("MasterFile") == "Tribunal.esm");
+		});
+	}
+
+	// Rejected patches leave the file untouched
+	void rejectsSizeMismatches() {
+		TESFileFormatDescription desc;
+		desc.loadFromFile(descriptionFile("morrowind.xml"));
+
+		writeFile(pluginFilename, buildPlugin());
+		auto before = readFile(pluginFilename);
+
+		{
+			TESGameData data;
+			data.load(pluginFilename, desc, writableOptions());
+
+			// The value doesn't fit the field
+			TESPARSE_CHECK_THROWS(data.patchHeaderField("Author", std::pmr::string(std::string(40, 'a'))));
+			TESPARSE_CHECK_THROWS(data.patchField(0, "DefaultValue", TESUInt(1)));
+
+			// The subrecord is larger than its layout
+			TESPARSE_CHECK_THROWS(data.patchField(1, "DefaultValue", 2.0f));
+
+			// The field isn't in the array
+			TESPARSE_CHECK_THROWS(data.patchHeaderField("Masters[2].MasterFileSize", TESUInt(1)));
+
+			data.flush();
+		}
+
+		TESPARSE_CHECK(readFile(pluginFilename) == before);
+
+		std::remove(pluginFilename);
+	}
+
+	void rejectsVariableOffsets() {
+		TESFileFormatDescription desc;
+		desc.loadFromMemory(reinterpret_cast<const unsigned char *>(variableOffsetDescription), static_cast<unsigned int>(strlen(variableOffsetDescription)));
+
+		auto plugin = PluginBuilder()
+			.header({})
+			.record("LIST")
+			.subrecord("DATA", Bytes().uint32(2).uint32(10).uint32(20).uint32(7))
+			.finish();
+		writeFile(pluginFilename, plugin);
+
+		{
+			TESGameData data;
+			data.load(pluginFilename, desc, writableOptions());
+
+			TESPARSE_CHECK_THROWS(data.patchField(0, "Trailer", TESUInt(8)));
+
+			// Fields before the array are still at fixed offsets
+			data.patchField(0, "Count", TESUInt(2));
+			data.flush();
+		}
+
+		TESPARSE_CHECK(readFile(pluginFilename) == plugin);
+
+		std::remove(pluginFilename);
+	}
+}
+
+int main() {
+	return runTests({
+		{ "patchesRecordHeaderField", patchesRecordHeaderField },
+		{ "patchesSubrecordField", patchesSubrecordField },
+		{ "patchesArrayMemberField", patchesArrayMemberField },
+		{ "rejectsSizeMismatches", rejectsSizeMismatches },
+		{ "rejectsVariableOffsets", rejectsVariableOffsets },
+	});
+}
@@ -0,0 +1,157 @@
+#include "TestSupport.h"
+
+#include <tesparse/TESFileFormatDescription.h>
+#include <tesparse/TESGameData.h>
+
+using namespace tesparse;
+using namespace tesparse::tests;
+
+namespace {
+	const char *sourceFilename = "TESGameDataWriterTest.esp";
+	const char *savedFilename = "TESGameDataWriterTest.saved.esp";
+
+	const std::vector<unsigned char> scriptBytecode{ 0x01, 0x02, 0x03, 0x04 };
+	const std::vector<unsigned char> changedScriptBytecode{ 0x05, 0x06 };
+
+	/*
+	 * A plugin with the contents that decoding doesn't keep: a fixed-length
+	 * string with bytes after its terminator, a zero-separated list in a
+	 * string that extends to the end of its subrecord, a string without a
+	 * terminator, an optional subrecord without fields and a subrecord that
+	 * is larger than its layout.
+	 */
+	std::vector<unsigned char> buildPlugin(const std::vector<unsigned char> &bytecode) {
+		return PluginBuilder()
+			.header({ { "Morrowind.esm", 79837557 }, { "Tribunal.esm", 4565686 } })
+			.record("GMST")
+			.subrecord("NAME", Bytes().string("sGreeting"))
+			.subrecord("STRV", Bytes().string("Hello"))
+			.record("SCPT", 0, 0x2000)
+			.subrecord("SCHD", Bytes().raw("script").uint8(0).raw("garbage").string("", 32 - 14).uint32(2).uint32(0).uint32(1).uint32(4).uint32(12))
+			.subrecord("SCVR", Bytes().string("first").string("second").string("third"))
+			.subrecord("SCDT", bytecode)
+			.subrecord("SCTX", Bytes().raw("begin script\nend"))
+			.record("CELL")
+			.subrecord("NAME", Bytes().string("Balmora"))
+			.subrecord("DATA", Bytes().uint32(1).int32(-3).int32(-2))
+			.subrecord("INTV", Bytes().uint32(0x12345678))
+			.record("GLOB")
+			.subrecord("NAME", Bytes().string("Counter"))
+			.subrecord("FNAM", Bytes().string("f"))
+			.subrecord("FLTV", Bytes().float32(1.5f).uint32(0xdeadbeef))
+			.finish();
+	}
+
+	size_t findRecord(const TESGameData &data, const char *name) {
+		for (size_t index = 0; index < data.recordCount(); index++) {
+			if (data.recordType(index) == name)
+				return index;
+		}
+
+		throw std::runtime_error(std::string("no record named ") + name);
+	}
+
+	TESLoadOptions passthroughOptions() {
+		TESLoadOptions options;
+		options.passthrough = true;
+		return options;
+	}
+
+	// load -> modifyRecord() without changes -> save -> the same bytes
+	void unchangedRecordsRoundTrip() {
+		TESFileFormatDescription desc;
+		desc.loadFromFile(descriptionFile("morrowind.xml"));
+
+		auto source = buildPlugin(scriptBytecode);
+		writeFile(sourceFilename, source);
+
+		{
+			TESGameData data;
+			data.load(sourceFilename, desc, passthroughOptions());
+
+			data.modifyHeader();
+			for (size_t index = 0; index < data.recordCount(); index++) {
+				data.modifyRecord(index);
+			}
+
+			data.save(savedFilename);
+		}
+
+		TESPARSE_CHECK(readFile(savedFilename) == source);
+
+		std::remove(sourceFilename);
+		std::remove(savedFilename);
+	}
+
+	// Changed values are encoded, while subrecords around them keep their source bytes
+	void changedValuesAreEncoded() {
+		TESFileFormatDescription desc;
+		desc.loadFromFile(descriptionFile("morrowind.xml"));
+
+		writeFile(sourceFilename, buildPlugin(scriptBytecode));
+
+		{
+			TESGameData data;
+			data.load(sourceFilename, desc, passthroughOptions());
+
+			auto &script = data.modifyRecord(findRecord(data, "Script"));
+			auto slot = script.layout->slot("ScriptBytecode");
+			script.fields[slot] = std::pmr::vector<unsigned char>(changedScriptBytecode.begin(), changedScriptBytecode.end(), data.memoryResource());
+
+			data.save(savedFilename);
+		}
+
+		TESPARSE_CHECK(readFile(savedFilename) == buildPlugin(changedScriptBytecode));
+
+		std::remove(sourceFilename);
+		std::remove(savedFilename);
+	}
+
+	// Values of subrecords that decoding didn't keep completely can't be changed
+	void changingIncompleteSubrecordsThrows() {
+		TESFileFormatDescription desc;
+		desc.loadFromFile(descriptionFile("morrowind.xml"));
+
+		writeFile(sourceFilename, buildPlugin(scriptBytecode));
+
+		auto check = [&](const char *name, const char *field, const TESValue &value) {
+			TESGameData data;
+			data.load(sourceFilename, desc, passthroughOptions());
+
+			auto &record = data.modifyRecord(findRecord(data, name));
+			record.fields[record.layout->slot(field)] = value;
+
+			TESPARSE_CHECK_THROWS(data.save(savedFilename));
+		};
+
+		check("Script", "ScriptSource", std::pmr::string("begin script\nend\n"));
+		check("Script", "LocalVariables", std::pmr::string("other"));
+		check("Script", "NumShorts", TESUInt(3));
+		check("GlobalVariable", "DefaultValue", 2.5f);
+
+		std::remove(sourceFilename);
+		std::remove(savedFilename);
+	}
+
+	void saveRequiresMapping() {
+		TESFileFormatDescription desc;
+		desc.loadFromFile(descriptionFile("morrowind.xml"));
+
+		writeFile(sourceFilename, buildPlugin(scriptBytecode));
+
+		TESGameData data;
+		data.load(sourceFilename, desc);
+		TESPARSE_CHECK_THROWS(data.save(savedFilename));
+
+		std::remove(sourceFilename);
+	}
+}
+
+int main() {
+	return runTests({
+		{ "unchangedRecordsRoundTrip", unchangedRecordsRoundTrip },
+		{ "changedValuesAreEncoded", changedValuesAreEncoded },
+		{ "changingIncompleteSubrecordsThrows", changingIncompleteSubrecordsThrows },
+		{ "saveRequiresMapping", saveRequiresMapping },
+	});
+}
@@ -0,0 +1,216 @@
+#ifndef TESPARSE_TESTS_TEST_SUPPORT_H
+#define TESPARSE_TESTS_TEST_SUPPORT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+ * Minimal test harness: a test is a function that throws on failure, and
+ * runTests() runs all tests of an executable, reporting each failure, and
+ * returns the exit code for CTest.
+ */
+
+#define TESPARSE_CHECK(condition) \
+	do { \
+		if (!(condition)) \
+			::tesparse::tests::fail(__FILE__, __LINE__, #condition); \
+	} while (false)
+
+#define TESPARSE_CHECK_THROWS(expression) \
+	do { \
+		bool thrown = false; \
+		try { \
+			expression; \
+		} \
+		catch (const std::exception &) { \
+			thrown = true; \
+		} \
+		if (!thrown) \
+			::tesparse::tests::fail(__FILE__, __LINE__, "expected an exception: " #expression); \
+	} while (false)
+
+namespace tesparse {
+	namespace tests {
+		struct TestCase {
+			const char *name;
+			void (*function)();
+		};
+
+		[[noreturn]] inline void fail(const char *file, int line, const char *what) {
+			std::stringstream error;
+			error << file << ":" << line << ": check failed: " << what;
+			throw std::runtime_error(error.str());
+		}
+
+		inline int runTests(const std::vector<TestCase> &tests) {
+			int failures = 0;
+
+			for (const auto &test : tests) {
+				try {
+					test.function();
+					printf("PASS %s\n", test.name);
+				}
+				catch (const std::exception &e) {
+					printf("FAIL %s: %s\n", test.name, e.what());
+					failures++;
+				}
+			}
+
+			return failures == 0 ? 0 : 1;
+		}
+
+		inline std::string descriptionFile(const char *name) {
+			return std::string(TESPARSE_DESCRIPTION_DIR) + "/" + name;
+		}
+
+		inline std::vector<unsigned char> readFile(const std::string &filename) {
+			std::ifstream stream(filename, std::ios::binary);
+			if (!stream)
+				throw std::runtime_error("cannot open " + filename);
+
+			return std::vector<unsigned char>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+		}
+
+		inline void writeFile(const std::string &filename, const std::vector<unsigned char> &data) {
+			std::ofstream stream(filename, std::ios::binary | std::ios::trunc);
+			stream.write(reinterpret_cast<const char *>(data.data()), data.size());
+			if (!stream)
+				throw std::runtime_error("cannot write " + filename);
+		}
+
+		/*
+		 * Builds plugin files in the framing of the Morrowind description:
+		 * records with a 16-byte header (Name, Size, Flags1, Flags2) holding
+		 * subrecords with an 8-byte header (Name, Size).
+		 */
+		class PluginBuilder {
+		public:
+			PluginBuilder &record(const char *fourcc, uint32_t flags1 = 0, uint32_t flags2 = 0) {
+				finishRecord();
+
+				m_recordStart = m_data.size();
+				appendFourCC(fourcc);
+				appendUInt32(0);
+				appendUInt32(flags1);
+				appendUInt32(flags2);
+				return *this;
+			}
+
+			PluginBuilder &subrecord(const char *fourcc, const std::vector<unsigned char> &contents) {
+				appendFourCC(fourcc);
+				appendUInt32(static_cast<uint32_t>(contents.size()));
+				m_data.insert(m_data.end(), contents.begin(), contents.end());
+				return *this;
+			}
+
+			// Header record with a HEDR subrecord and the given masters
+			PluginBuilder &header(const std::vector<std::pair<std::string, uint32_t>> &masters = {}) {
+				record("TES3");
+				subrecord("HEDR", Bytes().float32(1.3f).uint32(0).string("author", 32).string("description", 256));
+				for (const auto &master : masters) {
+					subrecord("MAST", Bytes().string(master.first));
+					subrecord("DATA", Bytes().uint32(master.second));
+				}
+				return *this;
+			}
+
+			std::vector<unsigned char> finish() {
+				finishRecord();
+				return m_data;
+			}
+
+			// Subrecord contents
+			class Bytes {
+			public:
+				Bytes &uint8(uint8_t value) {
+					m_data.push_back(value);
+					return *this;
+				}
+
+				Bytes &uint16(uint16_t value) {
+					return append(&value, sizeof(value));
+				}
+
+				Bytes &uint32(uint32_t value) {
+					return append(&value, sizeof(value));
+				}
+
+				Bytes &int32(int32_t value) {
+					return append(&value, sizeof(value));
+				}
+
+				Bytes &float32(float value) {
+					return append(&value, sizeof(value));
+				}
+
+				// Zero-terminated string
+				Bytes &string(const std::string_view &value) {
+					append(value.data(), value.size());
+					return uint8(0);
+				}
+
+				// Zero-padded string of a fixed length
+				Bytes &string(const std::string_view &value, size_t length) {
+					append(value.data(), value.size());
+					m_data.resize(m_data.size() - value.size() + length, 0);
+					return *this;
+				}
+
+				// String without a terminator, or any other raw bytes
+				Bytes &raw(const std::string_view &value) {
+					return append(value.data(), value.size());
+				}
+
+				inline operator const std::vector<unsigned char> &() const { return m_data; }
+
+			private:
+				Bytes &append(const void *data, size_t size) {
+					auto bytes = static_cast<const unsigned char *>(data);
+					m_data.insert(m_data.end(), bytes, bytes + size);
+					return *this;
+				}
+
+				std::vector<unsigned char> m_data;
+			};
+
+		private:
+			void appendFourCC(const char *fourcc) {
+				m_data.insert(m_data.end(), fourcc, fourcc + 4);
+			}
+
+			void appendUInt32(uint32_t value) {
+				auto bytes = reinterpret_cast<const unsigned char *>(&value);
+				m_data.insert(m_data.end(), bytes, bytes + sizeof(value));
+			}
+
+			void finishRecord() {
+				if (m_recordStart == NoRecord)
+					return;
+
+				auto size = static_cast<uint32_t>(m_data.size() - m_recordStart - 16);
+				memcpy(m_data.data() + m_recordStart + 4, &size, sizeof(size));
+				m_recordStart = NoRecord;
+			}
+
+			static constexpr size_t NoRecord = static_cast<size_t>(-1);
+
+			std::vector<unsigned char> m_data;
+			size_t m_recordStart = NoRecord;
+		};
+
+		using Bytes = PluginBuilder::Bytes;
+	}
+}
+
+#endif